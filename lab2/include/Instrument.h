@@ -1,9 +1,22 @@
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#include <fstream>
+#include <map>
+#include <random>
+#include <set>
+#include <tuple>
 
 using namespace llvm;
 
@@ -12,8 +25,18 @@ namespace instrument {
 struct Instrument : public FunctionPass {
   static char ID;
 
+  /* Sidecar entries: coverage map id, line, col */
+  std::set<std::tuple<unsigned int, unsigned int, unsigned int>> CoverageMap;
+  /* Source of the compile-time random block ids */
+  std::mt19937 Rng;
+
   Instrument() : FunctionPass(ID) {}
 
+  bool doInitialization(Module &M) override;
   bool runOnFunction(Function &F) override;
+  bool doFinalization(Module &M) override;
+
+private:
+  void instrumentBlocks(Function &F);
 };
 } // namespace instrument
@@ -0,0 +1,50 @@
+#ifndef BANDIT_H
+#define BANDIT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "Random.h"
+
+// Rewards between two updates of the arm probabilities
+#define BANDIT_UPDATE_PERIOD 1000
+// Weight left to older rewards at each update, about 10 periods of memory
+#define BANDIT_DECAY 0.9
+// Every arm keeps at least this probability, so none starves
+#define BANDIT_MIN_PROB 0.02
+
+/*
+ * Multi-armed bandit over mutation choices (operators, stacking depth).
+ * Every arm picked for a mutant is credited when the mutant finds new
+ * coverage or a crash. Probabilities follow the decayed find rate of each
+ * arm, on top of a floor that keeps exploring.
+ */
+class Bandit {
+public:
+  Bandit(int NumArms);
+  int pick(Random &Rng);
+  // Credit the arms picked since the last call, then start a new mutant
+  void reward(bool NewCoverage, bool Crash);
+  void print(FILE *F, const char *const *Names);
+  // Between two mutants, when no arm is pending
+  void save(FILE *F) const;
+  bool load(FILE *F);
+
+  // Lifetime counters per arm, for the stats, in executions of a mutant the arm was in
+  std::vector<uint64_t> Uses;
+  std::vector<uint64_t> Finds;
+  std::vector<uint64_t> Crashes;
+  std::vector<double> Prob;
+
+private:
+  int NumArms;
+  std::vector<double> RecentUses;
+  std::vector<double> RecentFinds;
+  // Arms picked for the current mutant, one bit each
+  uint64_t Pending;
+  uint64_t NumRewards;
+  void update();
+};
+
+#endif // BANDIT_H
@@ -0,0 +1,90 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// First field of a snapshot, and version of the snapshot and journal layout
+#define CHECKPOINT_MAGIC 0x54504b43
+#define CHECKPOINT_VERSION 3
+// Seconds between two checkpoints, the work a killed campaign can lose
+#define CHECKPOINT_SECONDS 60
+
+class Scheduler;
+
+// Raw fields of a snapshot, a short read fails the whole restore
+template <typename T> void writeRaw(FILE *F, const T *Data, size_t Count) {
+  fwrite(Data, sizeof(T), Count, F);
+}
+
+template <typename T> bool readRaw(FILE *F, T *Data, size_t Count) {
+  return fread(Data, sizeof(T), Count, F) == Count;
+}
+
+template <typename T> void writeVector(FILE *F, const std::vector<T> &Vector) {
+  uint64_t Size = Vector.size();
+  writeRaw(F, &Size, 1);
+  writeRaw(F, Vector.data(), Size);
+}
+
+template <typename T> bool readVector(FILE *F, std::vector<T> &Vector) {
+  uint64_t Size;
+  if (!readRaw(F, &Size, 1)) {
+    return false;
+  }
+  Vector.resize(Size);
+  return readRaw(F, Vector.data(), Size);
+}
+
+/*
+ * Checkpoints of a worker in its output directory, in two files:
+ *  - checkpoint_seeds(.N), a journal only ever appended to: every seed with
+ *    what the scheduler keeps of it (exec time, coverage tuples), and the
+ *    progress (times fuzzed, deterministic stage...) of the seeds scheduled
+ *    since the previous checkpoint, the later record of a seed wins;
+ *  - checkpoint(.N), a snapshot of everything else, whose size does not grow
+ *    with the corpus, written aside and renamed over the previous one.
+ * The snapshot records how much of the journal it goes with, and is only
+ * written once the journal is synced. A worker killed at any point resumes
+ * from the last snapshot, what the journal has past it is dropped.
+ */
+class Checkpoint {
+public:
+  Checkpoint();
+  ~Checkpoint();
+  // Suffix tells the workers of -j apart, as for the other files
+  void open(const std::string &OutDir, const std::string &Suffix);
+  bool exists() const;
+  // Seed Index was scheduled, its progress goes into the next checkpoint
+  void touch(size_t Index) {
+    if (Index >= Touched.size()) {
+      Touched.resize(Index + 1);
+    }
+    if (!Touched[Index]) {
+      Touched[Index] = true;
+      TouchedList.push_back(Index);
+    }
+  }
+  // Append what is new to the journal, then start the snapshot for the
+  // caller to write its state into. NULL if the files cannot be written.
+  FILE *begin(const std::vector<std::string> &Inputs, const Scheduler &Sched);
+  // Make the snapshot the checkpoint to resume from
+  bool commit(FILE *Snapshot);
+  // Replay the journal into Inputs and Sched, returns the snapshot at the
+  // caller's state, or NULL if there is no checkpoint to resume from
+  FILE *restore(std::vector<std::string> &Inputs, Scheduler &Sched);
+
+private:
+  std::string JournalPath;
+  std::string SnapshotPath;
+  FILE *Journal;
+  uint64_t JournalBytes;
+  // Seeds already in the journal
+  size_t NumSaved;
+  std::vector<bool> Touched;
+  std::vector<uint32_t> TouchedList;
+};
+
+#endif // CHECKPOINT_H
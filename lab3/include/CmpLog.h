@@ -0,0 +1,53 @@
+#ifndef CMPLOG_H
+#define CMPLOG_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Comparison table shared with the target, must match lib/runtime.c and Instrument.cpp
+#define CMP_MAP_W 4096
+#define CMP_MAP_H 8
+#define CMP_RTN_LEN 32
+#define CMP_TYPE_INS 1
+#define CMP_TYPE_RTN 2
+#define CMPLOG_ENV_VAR "__FUZZ_CMPLOG_SHM_ID"
+// Cap on the candidates of one input-to-state stage
+#define I2S_MAX_CANDIDATES 4096
+
+struct CmpHeader {
+  uint32_t Hits;
+  uint8_t Type;
+  // Operand bytes: integer width, or compared length of a buffer
+  uint8_t Size;
+  uint8_t Pad[2];
+};
+
+struct CmpOperands {
+  uint64_t V0;
+  uint64_t V1;
+};
+
+struct CmpRtnOperands {
+  uint8_t V0[CMP_RTN_LEN];
+  uint8_t V1[CMP_RTN_LEN];
+};
+
+struct CmpMap {
+  uint32_t Enabled;
+  CmpHeader Headers[CMP_MAP_W];
+  union {
+    CmpOperands Ins;
+    CmpRtnOperands Rtn;
+  } Log[CMP_MAP_W][CMP_MAP_H];
+};
+
+extern CmpMap *CmpLogMap;
+
+void initCmpLogMap();
+// Log the comparisons of the runs between the two calls
+void startCmpLog();
+void stopCmpLog();
+void collectInputToState(const std::string &Input, std::vector<std::string> &Candidates);
+
+#endif // CMPLOG_H
@@ -0,0 +1,17 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * Greedy set cover of the coverage tuples (see Coverage.h), shared by the
+ * cmin tool and the fuzzer's culling. Each tuple is assigned the cheapest
+ * input covering it, then the tuples are visited rarest first, keeping the
+ * assigned input of every tuple not covered yet. Costs are meant to be size
+ * times exec time, as in AFL.
+ */
+std::vector<size_t> distillCorpus(const std::vector<const std::vector<uint32_t> *> &Tuples,
+                                  const std::vector<double> &Costs);
+
+#endif // CORPUS_H
@@ -0,0 +1,64 @@
+#ifndef CORPUS_STORE_H
+#define CORPUS_STORE_H
+
+#include <cstdint>
+#include <string>
+
+// Record of an input in the index of a pack
+struct PackEntry {
+  uint64_t Offset;
+  uint32_t Size;
+  // N of the inputN file it stands for
+  uint32_t Id;
+};
+
+/*
+ * Packed store of the inputs of one kind (success, failure, hangs) of one
+ * worker: <name>.pack holds the inputs back to back, <name>.idx a PackEntry
+ * per input. Both are only appended to, the data before its index record,
+ * so that a reader never sees a record of data not written yet. A torn
+ * record at the end of the index, from a killed fuzzer, is dropped on open.
+ * Two writes per input, where a file per input costs an inode and its
+ * directory entry.
+ */
+class PackWriter {
+public:
+  PackWriter();
+  ~PackWriter();
+  // Base is the path without extension. Append keeps what is there already.
+  bool open(const std::string &Base, bool Append);
+  bool isOpen() const { return DataFd >= 0; }
+  // False if the input or its record could not be written whole
+  bool append(const std::string &Input, uint32_t Id);
+  // Id of the last input in the pack, false if it has none
+  bool lastId(uint32_t &Id) const;
+
+private:
+  int DataFd;
+  int IndexFd;
+  uint64_t DataBytes;
+  bool HasLast;
+  uint32_t LastId;
+};
+
+/*
+ * Both files of a pack mapped read-only, inputs are read in place.
+ */
+class PackReader {
+public:
+  PackReader();
+  ~PackReader();
+  bool open(const std::string &Base);
+  size_t size() const { return NumEntries; }
+  const PackEntry &entry(size_t i) const { return Index[i]; }
+  const char *data(size_t i) const { return Data + Index[i].Offset; }
+
+private:
+  const char *Data;
+  size_t DataBytes;
+  const PackEntry *Index;
+  size_t IndexBytes;
+  size_t NumEntries;
+};
+
+#endif // CORPUS_STORE_H
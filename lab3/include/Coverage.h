@@ -0,0 +1,82 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Coverage map shared with the target, must match lib/runtime.c and Instrument.cpp
+#define MAP_SIZE_POW2 16
+#define MAP_SIZE (1 << MAP_SIZE_POW2)
+// Environment variable carrying the SysV shm id of the map to the target
+#define SHM_ENV_VAR "__FUZZ_SHM_ID"
+// A map entry with the bucket of its hit count, (entry << TUPLE_BITS) | log2(bucket)
+#define TUPLE_BITS 3
+#define NUM_TUPLES (MAP_SIZE << TUPLE_BITS)
+
+// Stack frames in a crash report, they make its signature
+#define CRASH_FRAMES 3
+
+// Written by the runtime when the target crashes, right after the map in the
+// same shared memory. Must match lib/runtime.c.
+enum CrashKind { CRASH_NONE, CRASH_SANITIZER, CRASH_SIGNAL };
+struct CrashReport {
+  uint32_t Kind;
+  uint32_t Signal;
+  // Source location of a sanitizer report
+  int32_t Line;
+  int32_t Col;
+  // Innermost stack frames of a crash by signal, outside libc and the
+  // runtime: module index << 48 | offset in the module
+  uint32_t NumFrames;
+  uint32_t Pad;
+  uint64_t Frames[CRASH_FRAMES];
+};
+
+// Map written by the current execution, hit counts until classifyCounts
+extern uint8_t *TraceBits;
+// What the runtime reported on the current execution, reset with the map
+extern CrashReport *LastCrash;
+// Bucket bits never hit by any execution are set, shared by all workers
+extern uint8_t *VirginBits;
+// Same for the executions that timed out, a hang is kept if it adds to it
+extern uint8_t *VirginHangs;
+
+void initCoverageMap();
+void initVirginMap(bool Shared);
+void resetCoverageMap();
+// Hit counts to one bit per bucket: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+
+void classifyCounts(uint8_t *Trace);
+bool hasNewCoverage(uint8_t *Virgin);
+// Tuples of the entries hit in a classified map, in increasing order
+void traceTuples(const uint8_t *Trace, std::vector<uint32_t> &Tuples);
+int countCoverage(uint8_t *Virgin);
+// Mark the entries whose bucket in the classified map Trace differs from Tuples,
+// returns the number of entries newly marked
+int markVariable(const std::vector<uint32_t> &Tuples, const uint8_t *Trace, uint8_t *Variable);
+// Hash of the map written by the last execution, to tell if two runs took the same path
+uint64_t hashCoverageMap();
+
+/*
+ * Set of (line, col) coverage points from the .cov file, open addressing
+ * with linear probing so that a lookup stays O(1) as coverage grows.
+ */
+class CoverageSet {
+public:
+  CoverageSet();
+  // Returns true if Key was not in the set yet
+  bool insert(uint64_t Key);
+  size_t size() const { return Count; }
+  void save(FILE *F) const;
+  bool load(FILE *F);
+
+private:
+  std::vector<uint64_t> Slots;
+  size_t Count;
+  void grow();
+};
+
+uint64_t coverageKey(const std::string &Line);
+
+#endif // COVERAGE_H
@@ -0,0 +1,62 @@
+#ifndef DETERMINISTIC_H
+#define DETERMINISTIC_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Arithmetic stages add and subtract 1 to ARITH_MAX
+#define ARITH_MAX 35
+// Deterministic mutants per visit of a seed: a DET_SHARE-th of its havoc
+// energy, at least DET_SLICE, so that havoc keeps most of the executions
+#define DET_SHARE 4
+#define DET_SLICE 64
+// Longer seeds skip the deterministic stage, they take ~200 execs per byte
+#define DET_MAX_LEN 4096
+// Denser effector maps are treated as all effective
+#define EFF_MAX_PERC 90
+// Shorter seeds are not worth an effector map, every byte is effective
+#define EFF_MIN_LEN 32
+
+// AFL's stages, in order
+enum DetStage {
+  DET_FLIP1,
+  DET_FLIP2,
+  DET_FLIP4,
+  DET_FLIP8,
+  DET_FLIP16,
+  DET_FLIP32,
+  DET_ARITH8,
+  DET_ARITH16,
+  DET_ARITH32,
+  DET_INTEREST8,
+  DET_INTEREST16,
+  DET_INTEREST32,
+  DET_DONE
+};
+
+/*
+ * Where the deterministic stage of a seed stands, kept with the seed so that
+ * no mutant is made twice across visits. Zero-initialized means not started.
+ */
+struct DetProgress {
+  uint8_t Stage;
+  // Bit index in the 1/2/4-bit flips, byte index in the other stages
+  uint32_t Pos;
+  // Variant at Pos: delta and sign, or interesting value, and byte order
+  uint32_t Step;
+  // Whether the seed's own coverage was hashed
+  bool Started;
+  // Visit of the seed (its TimesFuzzed) in which the last slice ran
+  uint32_t Visit;
+  uint64_t SeedHash;
+  // Per byte, whether flipping it changed the coverage, filled by DET_FLIP8
+  std::vector<uint8_t> Effector;
+};
+
+// Make the next deterministic mutant of Seed into Mutant, returns its stage or DET_DONE
+int nextDeterministic(const std::string &Seed, DetProgress &Progress, std::string &Mutant);
+// After running a DET_FLIP8 mutant, record whether it changed the coverage
+void markEffector(DetProgress &Progress, bool Changed);
+
+#endif // DETERMINISTIC_H
@@ -0,0 +1,15 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include <string>
+#include <vector>
+
+// Longest token kept, must match MaxTokenLen in DictionaryPass.cpp
+#define MAX_TOKEN_LEN 64
+
+// Tokens of <target>.dict, integers in every byte order and width they fit
+extern std::vector<std::string> Dictionary;
+
+int loadDictionary(const std::string &Path);
+
+#endif // DICTIONARY_H
@@ -0,0 +1,152 @@
+#ifndef GRAMMAR_H
+#define GRAMMAR_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Random.h"
+
+// Longer seeds are not parsed, they keep to the byte-level operators
+#define GRAMMAR_MAX_LEN (1 << 16)
+// Rules a parse may nest, deeper inputs are not parsed
+#define GRAMMAR_MAX_NESTING 1000
+// Rule levels below an expanded node, and most items of a generated '*'
+#define GRAMMAR_EXPAND_DEPTH 6
+#define GRAMMAR_MAX_REPEAT 3
+// Most copies of a node the repeat operator makes
+#define GRAMMAR_MAX_COPIES 4
+
+#define NUM_TREE_MUTATIONS 5
+
+// Operator names for the stats, by TreeMutator::mutateWith index
+extern const char *const TreeMutationNames[NUM_TREE_MUTATIONS];
+
+enum SymbolKind { SYMBOL_LITERAL, SYMBOL_CLASS, SYMBOL_RULE };
+
+// One symbol of an alternative, matched once, or per Repeat '?' or '*'
+struct GrammarSymbol {
+  uint8_t Kind;
+  char Repeat;
+  // Into Literals, Classes or Rules of the grammar
+  uint32_t Index;
+};
+
+/*
+ * A rule is an ordered choice of alternatives, the first that matches wins.
+ * Rules named in lowercase become tree nodes, in uppercase leaf nodes (their
+ * inner rules make no node), and rules starting with '_' no node at all.
+ * Those are separators, whitespace..., generated as short as they can be.
+ */
+struct GrammarRule {
+  std::string Name;
+  std::vector<std::vector<GrammarSymbol>> Alternatives;
+  bool Token;
+  bool Hidden;
+  // Fewest rule levels down to text only, and the alternative that has them
+  uint32_t MinHeight;
+  uint32_t MinAlternative;
+};
+
+// Bytes a character class matches, and the same as a list to draw from
+struct CharClass {
+  uint64_t Bits[4];
+  std::string Chars;
+  bool has(uint8_t C) const { return Bits[C >> 6] >> (C & 63) & 1; }
+};
+
+enum NodeFlags { NODE_OPTIONAL = 1, NODE_REPEATED = 2 };
+
+// Node of a derivation tree, the text of the seed it derives
+struct TreeNode {
+  uint32_t Rule;
+  uint32_t Begin;
+  uint32_t End;
+  // NodeFlags: matched by a '?' or '*' symbol, removing it keeps the input valid
+  uint32_t Flags;
+};
+
+enum TreeState { TREE_UNPARSED, TREE_PARSED, TREE_INVALID };
+
+/*
+ * Derivation tree of a seed: its nodes in preorder, all in one vector, and
+ * pointing into the seed's text rather than holding a copy of it. Parsed
+ * once per seed, on its first selection. Zero-initialized means unparsed.
+ */
+struct DerivationTree {
+  uint8_t State;
+  std::vector<TreeNode> Nodes;
+};
+
+/*
+ * Grammar for the structured mutations, from a description of one rule per
+ * line, the first rule the whole input:
+ *   name = symbols | symbols ...
+ * where a symbol is 'literal', [character class] or a rule name, followed
+ * by ? (optional) or * (any number). Lines starting with # are comments.
+ */
+class Grammar {
+public:
+  // Description text, or the name of a built-in grammar (json)
+  bool load(const std::string &Description);
+  bool loaded() const { return !Rules.empty(); }
+  // TREE_PARSED or TREE_INVALID, the input must match as a whole
+  void parse(const std::string &Input, DerivationTree &Tree) const;
+  // Append a random derivation of Rule, Depth rule levels deep at most
+  // before the shortest alternatives are taken
+  void generate(uint32_t Rule, int Depth, std::string &Out, Random &Rng) const;
+
+  std::vector<GrammarRule> Rules;
+  std::vector<std::string> Literals;
+  std::vector<CharClass> Classes;
+
+private:
+  bool parseSymbol(const std::string &Text, size_t &Pos, GrammarSymbol &Symbol, int Line);
+  bool computeHeights();
+  bool match(uint32_t Rule, const std::string &Input, size_t &Pos, uint32_t Flags,
+             int Nesting, std::vector<TreeNode> *Nodes) const;
+  bool matchSymbol(const GrammarSymbol &Symbol, const std::string &Input, size_t &Pos,
+                   uint32_t Flags, int Nesting, std::vector<TreeNode> *Nodes) const;
+};
+
+// Seed and tree for the splice operator, set by the fuzzer, NULL if there is none
+extern const std::string *(*TreeSplicePartner)(Random &Rng, const DerivationTree **Tree);
+
+/*
+ * Tree-level mutations of one seed, stacked. Each picks a node of the seed's
+ * tree and the text that takes its place: another node of the same rule,
+ * from the seed or from another one, a fresh derivation of its rule, copies
+ * of it or nothing. finish writes the seed with every edit that does not
+ * overlap an earlier one. The texts stay in the seeds or in one reused
+ * buffer, so that mutating does not allocate.
+ */
+class TreeMutator {
+public:
+  explicit TreeMutator(const Grammar &G);
+  void start(const std::string &Seed, const DerivationTree &Tree);
+  void mutateWith(int Operator, Random &Rng);
+  void finish(std::string &Mutant);
+
+private:
+  // Text of the node from Begin to End replaced by Copies copies of Len
+  // bytes of Source at From
+  struct Edit {
+    uint32_t Begin;
+    uint32_t End;
+    const std::string *Source;
+    uint32_t From;
+    uint32_t Len;
+    uint32_t Copies;
+  };
+  const Grammar &G;
+  const std::string *Seed;
+  const DerivationTree *Tree;
+  std::vector<Edit> Edits;
+  std::string Generated;
+  void addEdit(const TreeNode &Node, const std::string *Source, uint32_t From, uint32_t Len,
+               uint32_t Copies);
+  size_t pickNode(uint32_t Flags, Random &Rng) const;
+  void expand(const TreeNode &Node, Random &Rng);
+};
+
+#endif // GRAMMAR_H
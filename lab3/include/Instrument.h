@@ -1,9 +1,26 @@
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#include <fstream>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <tuple>
 
 using namespace llvm;
 
@@ -13,8 +30,36 @@ struct Instrument : public FunctionPass {
   static char ID;
   static const char *checkFunctionName;
 
+  /* Sidecar entries: coverage map id, line, col */
+  std::set<std::tuple<unsigned int, unsigned int, unsigned int>> CoverageMap;
+  /* Source of the compile-time random block ids */
+  std::mt19937 Rng;
+
   Instrument() : FunctionPass(ID) {}
 
+  bool doInitialization(Module &M) override;
   bool runOnFunction(Function &F) override;
+  bool doFinalization(Module &M) override;
+
+private:
+  void instrumentBlocks(Function &F);
+  void instrumentCmpLog(Function &F, std::vector<Instruction*> &Sites);
+};
+
+/*
+ * Writes the integer and string constants the program compares against,
+ * as a dictionary for the fuzzer's token operators.
+ */
+struct DictionaryPass : public ModulePass {
+  static char ID;
+  std::set<std::string> Tokens;
+
+  DictionaryPass() : ModulePass(ID) {}
+
+  bool runOnModule(Module &M) override;
+
+private:
+  void addInteger(Value *V);
+  void addString(Value *V);
 };
 } // namespace instrument
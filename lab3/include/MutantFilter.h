@@ -0,0 +1,45 @@
+#ifndef MUTANT_FILTER_H
+#define MUTANT_FILTER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Memory cap and false-positive rate of the duplicate mutant filter
+#define MUTANT_FILTER_BYTES (16 << 20)
+#define MUTANT_FILTER_FP_RATE 0.001
+
+/*
+ * Blocked Bloom filter of the mutants tried so far, in fixed memory.
+ * Every mutant sets its bits within a single cache line. Once more mutants
+ * are inserted than the filter holds at the target false-positive rate,
+ * it is cleared and starts over (a rebuild).
+ */
+class MutantFilter {
+public:
+  MutantFilter(size_t Bytes, double FalsePositiveRate);
+  ~MutantFilter();
+  bool contains(const std::string &Mutant);
+  void insert(const std::string &Mutant);
+  double fillRatio() const;
+  // Keep the bits in the file at Path, with Keep those already in it
+  bool mapFile(const std::string &Path, bool Keep);
+  // Counters only, the bits are in the file
+  void save(FILE *F) const;
+  bool load(FILE *F);
+
+  // Stats
+  uint64_t NumDuplicates;
+  uint64_t NumInserted;
+  uint64_t NumRebuilds;
+
+private:
+  uint64_t *Blocks;
+  size_t NumBlocks;
+  int NumProbes;
+  uint64_t Capacity;
+  uint64_t NumSetBits;
+  bool Mapped;
+};
+
+#endif // MUTANT_FILTER_H
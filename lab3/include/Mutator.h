@@ -0,0 +1,41 @@
+#ifndef MUTATOR_H
+#define MUTATOR_H
+
+#include <string>
+
+#include "Random.h"
+
+// Mutants never grow past this, seeds are truncated to it
+#define MAX_INPUT_LEN (1 << 20)
+// Havoc stacks 1, 2, 4, ... up to 2^(HAVOC_STACK_POW2 - 1) operators
+#define HAVOC_STACK_POW2 4
+
+#define NUM_MUTATION_METHODS 10
+#define ASCII_NUM 256
+
+// Operator names for the stats, by mutateWith index
+extern const char *const MutationNames[NUM_MUTATION_METHODS];
+// Second parent for mutateSplice, set by the fuzzer, NULL result if there is none
+extern const std::string *(*SplicePartner)(Random &Rng);
+
+/*
+ * Mutation operators edit Data in place. Data is reserved to MAX_INPUT_LEN
+ * once (see initMutationBuffer), so resizing within the cap never touches
+ * the heap and the mutation loop runs without allocating. All random
+ * choices come from the caller's Rng.
+ */
+void initMutationBuffer(std::string &Data);
+void mutateReplace(std::string &Data, Random &Rng);
+void mutateSwapAdjacent(std::string &Data, Random &Rng);
+void mutateCycle(std::string &Data, Random &Rng);
+void mutateRemove(std::string &Data, Random &Rng);
+void mutateInsert(std::string &Data, Random &Rng);
+void mutateRemoveMultiple(std::string &Data, Random &Rng);
+void mutateInsertMultiple(std::string &Data, Random &Rng);
+void mutateDictInsert(std::string &Data, Random &Rng);
+void mutateDictOverwrite(std::string &Data, Random &Rng);
+void mutateSplice(std::string &Data, Random &Rng);
+void mutateWith(int Operator, std::string &Data, Random &Rng);
+void mutateHavoc(std::string &Data, Random &Rng);
+
+#endif // MUTATOR_H
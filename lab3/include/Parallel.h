@@ -0,0 +1,15 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <string>
+#include <vector>
+
+// Capacity of the seed queue shared by the workers of -j
+#define SEED_QUEUE_ENTRIES (1 << 20)
+#define SEED_QUEUE_BYTES (1UL << 30)
+
+int startWorkers(int NumWorkers);
+void publishSeed(std::string &Seed);
+void pollSeeds(std::vector<std::string> &Seeds);
+
+#endif // PARALLEL_H
@@ -0,0 +1,13 @@
+#ifndef PERSISTENT_H
+#define PERSISTENT_H
+
+#include <string>
+
+// Executions by one persistent child before a fresh one is forked
+#define PERSISTENT_ITERATIONS 100000
+
+bool initPersistent(std::string &Library);
+bool persistentActive();
+int runTargetPersistent(std::string &Target, std::string &Input);
+
+#endif // PERSISTENT_H
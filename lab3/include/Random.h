@@ -0,0 +1,44 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * xoshiro256** generator. Each worker owns one, seeded from randomSeed.txt
+ * and the worker index, so that a run is reproducible from its seed.
+ */
+class Random {
+public:
+  explicit Random(uint64_t Seed) { seed(Seed); }
+  void seed(uint64_t Seed);
+  // Fill Buf with Len random bytes, 8 per step
+  void fill(uint8_t *Buf, size_t Len);
+
+  uint64_t next() {
+    uint64_t Result = rotl(State[1] * 5, 7) * 9;
+    uint64_t T = State[1] << 17;
+    State[2] ^= State[0];
+    State[3] ^= State[1];
+    State[1] ^= State[2];
+    State[0] ^= State[3];
+    State[2] ^= T;
+    State[3] = rotl(State[3], 45);
+    return Result;
+  }
+
+  // Uniform in [0, Bound), multiply-shift rather than a division
+  uint64_t below(uint64_t Bound) {
+    return (uint64_t)((unsigned __int128)next() * Bound >> 64);
+  }
+
+  // Uniform in [0, 1), the top 53 bits over 2^53
+  double real() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+  uint64_t State[4];
+
+private:
+  static uint64_t rotl(uint64_t X, int K) { return (X << K) | (X >> (64 - K)); }
+};
+
+#endif // RANDOM_H
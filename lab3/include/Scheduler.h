@@ -0,0 +1,114 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "Deterministic.h"
+#include "Random.h"
+
+// Energy of a seed is the number of mutants made from it per visit
+#define BASE_ENERGY 100
+#define MAX_ENERGY 3200
+// Cap on the schedule factor applied to the base energy
+#define MAX_FACTOR 32
+// Random seeds compared when picking a splice partner
+#define SPLICE_CANDIDATES 4
+// Hash functions of the coverage signature of a seed, see SeedInfo
+#define EDGE_SIG_HASHES 16
+// Percent chances to pass over a seed, as in AFL: any seed but the favored
+// ones waiting for their first visit, while there are some; else seeds that
+// are not favored, if fuzzed before or not. The latter only in queues of
+// more than SKIP_MIN_SEEDS.
+#define SKIP_TO_NEW_PROB 99
+#define SKIP_NFAV_OLD_PROB 95
+#define SKIP_NFAV_NEW_PROB 75
+#define SKIP_MIN_SEEDS 10
+
+// Power schedules of AFLFast, selected with -p
+enum Schedule { SCHEDULE_EXPLORE, SCHEDULE_FAST, SCHEDULE_COE, SCHEDULE_RARE };
+
+bool parseSchedule(const char *Name, Schedule &Power);
+
+struct SeedInfo {
+  size_t Size;
+  // 0 when the seed was never timed, it cannot be top-rated then
+  uint64_t ExecUs;
+  uint32_t TimesFuzzed;
+  // Mutants of this seed that found new coverage
+  uint32_t NumChildren;
+  // Coverage tuples (map entry and hit-count bucket) of the seed, see Coverage.h
+  std::vector<uint32_t> Tuples;
+  // Least hash of the tuples under each hash function (minhash): the share
+  // of equal entries of two seeds estimates the overlap of their coverage,
+  // however many tuples they have
+  uint32_t EdgeSig[EDGE_SIG_HASHES];
+  // Whether the input-to-state stage ran on the seed
+  bool CmpLogDone;
+  // Left out of the minimal covering set at the last cull, never scheduled
+  bool Redundant;
+  // Tuples for which the seed is the cheapest known (size x exec time), the
+  // seed is favored if there is any
+  uint32_t NumTopRated;
+  // Checkpoint of the deterministic stage on the seed
+  DetProgress Det;
+};
+
+/*
+ * Cycles through the seeds like AFL's queue, staying on each one for as many
+ * mutants as its energy. Energy starts from a performance score (exec time,
+ * size, children) scaled by the schedule, where the rarity of a seed is the
+ * number of executions that hit its least covered edge. Every cycle with new
+ * seeds first culls the queue down to a covering set (see Corpus.h). Between
+ * culls, seeds that are top-rated for no tuple are mostly passed over.
+ */
+class Scheduler {
+public:
+  Scheduler(Schedule Power);
+  ~Scheduler();
+  // Trace is the coverage map of the seed's execution, or NULL if unknown
+  void addSeed(size_t Size, uint64_t ExecUs, const uint8_t *Trace);
+  void addSeed(size_t Size, uint64_t ExecUs, std::vector<uint32_t> &&Tuples);
+  // Count the edges hit by the last execution
+  void recordExecution(const uint8_t *Trace);
+  // A mutant of the current seed found new coverage
+  void creditChild();
+  // Index of the seed to mutate next
+  size_t next(Random &Rng);
+  // Second parent to splice with the current seed, SIZE_MAX if there is none
+  size_t partner(Random &Rng);
+  uint32_t energy(size_t Index);
+  // Where the queue stands, the seeds themselves are checkpointed apart.
+  // load expects the seeds added back first, in the same order.
+  void save(FILE *F) const;
+  bool load(FILE *F);
+
+  std::vector<SeedInfo> Seeds;
+  Schedule Power;
+  size_t NumRedundant;
+
+private:
+  uint32_t *EdgeHits;
+  // Per tuple, index of the cheapest seed covering it, UINT32_MAX if none
+  uint32_t *TopRated;
+  // Favored seeds never fuzzed yet
+  size_t NumPendingFavored;
+  size_t Current;
+  uint32_t Remaining;
+  uint64_t TotalExecUs;
+  uint64_t NumTimed;
+  uint64_t TotalSize;
+  // Mean rarity of the seeds, refreshed once per cycle
+  double MeanRarity;
+  // Number of seeds at the last cull
+  size_t CulledSize;
+
+  uint64_t rarity(const SeedInfo &Seed);
+  void startCycle();
+  void cull();
+  void setTopRated(uint32_t Tuple, uint32_t Index);
+  bool skip(const SeedInfo &Seed, Random &Rng);
+};
+
+#endif // SCHEDULER_H
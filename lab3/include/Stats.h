@@ -0,0 +1,77 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "Mutator.h"
+
+// First field of a stats file, and version of the FuzzerStats layout
+#define STATS_MAGIC 0x5354465a
+#define STATS_VERSION 1
+// Crash buckets listed in the stats file, all of them are in crash_buckets
+#define STATS_MAX_BUCKETS 64
+// Seconds between two refreshes of the stats file, and between two rows of plot_data
+#define STATS_REFRESH_SECONDS 1
+#define STATS_PLOT_SECONDS 5
+
+struct BucketStats {
+  uint64_t Signature;
+  uint64_t Count;
+  // CrashKind, with the signal or the sanitizer's line and column
+  uint32_t Kind;
+  uint32_t Signal;
+  int32_t Line;
+  int32_t Col;
+};
+
+/*
+ * Counters of one worker, in the file <output dir>/fuzzer_stats(.N) mapped
+ * shared, that a monitor reads while the fuzzer runs (see Monitor.cpp).
+ * Executions only increment the first counters, plain stores into the
+ * worker's own file. The rest is refreshed every STATS_REFRESH_SECONDS,
+ * and may be read half refreshed.
+ */
+struct FuzzerStats {
+  uint32_t Magic;
+  uint32_t Version;
+  uint32_t Pid;
+  uint32_t Worker;
+  // Wall clock, ms since the epoch
+  uint64_t StartMs;
+  uint64_t RefreshMs;
+
+  // Updated by every execution
+  uint64_t NumExecs;
+  uint64_t TotalExecUs;
+  uint64_t NumTimeouts;
+  // Map entries hit differently by two runs of the same seed
+  uint64_t NumVariable;
+
+  // Refreshed
+  double ExecsPerSec;
+  // Percent of the covered map entries that are not variable
+  double Stability;
+  uint64_t NumMutants;
+  uint64_t NumDuplicates;
+  uint64_t NumSeeds;
+  uint64_t NumRedundant;
+  uint64_t CoveragePoints;
+  uint64_t NumCrashes;
+  uint64_t NumHangs;
+  uint64_t NumBuckets;
+  uint64_t OperatorUses[NUM_MUTATION_METHODS];
+  uint64_t OperatorFinds[NUM_MUTATION_METHODS];
+  uint64_t OperatorCrashes[NUM_MUTATION_METHODS];
+  BucketStats Buckets[STATS_MAX_BUCKETS];
+};
+
+// Create and map the stats file, NULL if it cannot be
+FuzzerStats *mapStats(const std::string &Path, int Worker);
+// Open the time series for appending, with a header if it is new
+FILE *openPlot(const std::string &Path);
+void appendPlotRow(FILE *Plot, const FuzzerStats &Stats);
+uint64_t wallClockMs();
+
+#endif // STATS_H
@@ -0,0 +1,50 @@
+#ifndef TRIAGE_H
+#define TRIAGE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+
+#include "Coverage.h"
+
+struct CrashBucket {
+  // Report of the first crash in the bucket
+  CrashReport Report;
+  // Wait status of that crash
+  int Status;
+  uint64_t Count;
+  // Size of the input kept for the bucket
+  size_t Size;
+};
+
+/*
+ * Groups crashes by the report of the runtime: sanitizer reports by source
+ * location, crashes by signal on the signal and the hash of their innermost
+ * stack frames (see lib/runtime.c). Without a report, as from a target not
+ * linked with the runtime, there is only the wait status to go by. Only the
+ * smallest input of each bucket is kept, as failure/input-<signature>, so
+ * that workers sharing the output directory share the buckets as well.
+ */
+class CrashTriage {
+public:
+  CrashTriage();
+  // Returns whether Input was kept: a new bucket, or smaller than the input kept
+  bool add(const CrashReport &Report, int Status, const std::string &Input,
+           const std::string &OutDir);
+  // One line per bucket: signature, what crashed, count and size of the input kept
+  void print(FILE *F);
+  size_t size() const { return Buckets.size(); }
+  const std::unordered_map<uint64_t, CrashBucket> &buckets() const { return Buckets; }
+  void save(FILE *F) const;
+  bool load(FILE *F);
+
+  uint64_t NumCrashes;
+
+private:
+  std::unordered_map<uint64_t, CrashBucket> Buckets;
+};
+
+uint64_t crashSignature(const CrashReport &Report, int Status);
+
+#endif // TRIAGE_H
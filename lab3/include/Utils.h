@@ -1,3 +1,4 @@
+#include <cstdint>
 #include <dirent.h>
 #include <fstream>
 #include <iostream>
@@ -7,13 +8,45 @@
 #include <streambuf>
 #include <string>
 #include <sys/stat.h>
+#include <sys/wait.h>
+
+// Fork server control pipe, the status pipe is FORKSRV_FD + 1 (see lib/runtime.c)
+#define FORKSRV_FD 198
+// Wall-clock limit for a single execution, unless calibrated or set with -t.
+// Also the limit under which a timeout is confirmed as a hang.
+#define EXEC_TIMEOUT_MS 1000
+// Calibrated limit: TIMEOUT_FACTOR times the mean exec time of the seeds, at
+// least twice the slowest one, rounded up to TIMEOUT_STEP_MS
+#define TIMEOUT_FACTOR 5
+#define TIMEOUT_STEP_MS 20
+// Address space limit of the target in MB, unless set with -m (0 for none)
+#define MEM_LIMIT_MB 512
+// Returned by runTarget instead of a wait status when the execution timed out
+#define RUN_TIMEOUT -1
+
+// What an execution came to, see classifyRun
+enum RunResult { RESULT_OK, RESULT_CRASH, RESULT_SANITIZER, RESULT_TIMEOUT, RESULT_OOM };
 
 extern int successCount;
 extern int failureCount;
+extern int hangCount;
+extern int StoreStride;
+// Limits applied to the target, set before the first execution but the timeout
+extern int ExecTimeoutMs;
+extern int MemLimitMb;
 
 std::string readOneFile(std::string &Path);
 int runTarget(std::string &Target, std::string &Input);
+int runTargetSpawn(std::string &Target, std::string &Input);
+bool startForkServer(std::string &Target);
+int runTargetForkServer(std::string &Input);
+RunResult classifyRun(int Status);
+int calibratedTimeout(uint64_t MeanExecUs, uint64_t MaxExecUs);
 void initialize(std::string &OutDir);
+// The store*Input functions append to packs (see CorpusStore.h), opened on the
+// first input: one set per worker told apart by Suffix, emptied unless Append
+void configureStores(const std::string &Suffix, bool Append);
 void storePassingInput(std::string &Input, std::string &OutDir);
 void storeCrashingInput(std::string &Input, std::string &OutDir);
+void storeHangingInput(std::string &Input, std::string &OutDir);
 
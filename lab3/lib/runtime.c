@@ -1,16 +1,313 @@
+#define _GNU_SOURCE
+#include <link.h>
+#include <execinfo.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/shm.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* Must match FORKSRV_FD in Utils.h: control pipe, status pipe is FORKSRV_FD + 1 */
+#define FORKSRV_FD 198
+/* Must match Coverage.h */
+#define MAP_SIZE_POW2 16
+#define MAP_SIZE (1 << MAP_SIZE_POW2)
+#define SHM_ENV_VAR "__FUZZ_SHM_ID"
+/* Must match CmpLog.h */
+#define CMP_MAP_W 4096
+#define CMP_MAP_H 8
+#define CMP_RTN_LEN 32
+#define CMP_TYPE_INS 1
+#define CMP_TYPE_RTN 2
+#define CMPLOG_ENV_VAR "__FUZZ_CMPLOG_SHM_ID"
+/* Must match CrashReport in Coverage.h */
+#define CRASH_SANITIZER 1
+#define CRASH_SIGNAL 2
+/* Innermost frames of the target kept in a crash report */
+#define CRASH_FRAMES 3
+
+struct crash_report {
+  unsigned int kind;
+  unsigned int signal;
+  int line;
+  int col;
+  unsigned int num_frames;
+  unsigned int pad;
+  /* Module index << 48 | offset in the module, or the address in a module
+     loaded after init, see __crash_frames__ */
+  unsigned long long frames[CRASH_FRAMES];
+};
+
+/*
+ * Coverage map updated inline by the instrumentation, followed by the crash
+ * report. Points at a dummy map until the fuzzer's shared map is attached,
+ * so standalone runs work.
+ */
+unsigned char __cov_initial__[MAP_SIZE + sizeof(struct crash_report)];
+unsigned char *__cov_area_ptr__ = __cov_initial__;
+
+static struct crash_report *__crash_report__(void) {
+  return (struct crash_report *)(__cov_area_ptr__ + MAP_SIZE);
+}
+
+/*
+ * Address ranges of the modules loaded at init, so that the crash handler
+ * turns return addresses into module offsets with arithmetic alone, rather
+ * than with dladdr from a signal handler. Frames of libc and the runtime
+ * are left out.
+ */
+#define MAX_MODULES 64
+
+struct module_range {
+  unsigned long base;
+  unsigned long start;
+  unsigned long end;
+  int skip;
+};
+
+static struct module_range __modules__[MAX_MODULES];
+static int __num_modules__;
+
+static int __add_module__(struct dl_phdr_info *info, size_t size, void *data) {
+  (void)size;
+  (void)data;
+  if (__num_modules__ == MAX_MODULES) {
+    return 1;
+  }
+  struct module_range *m = &__modules__[__num_modules__];
+  m->base = info->dlpi_addr;
+  m->start = (unsigned long)-1;
+  m->end = 0;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+    if (phdr->p_type == PT_LOAD) {
+      unsigned long start = info->dlpi_addr + phdr->p_vaddr;
+      m->start = start < m->start ? start : m->start;
+      m->end = start + phdr->p_memsz > m->end ? start + phdr->p_memsz : m->end;
+    }
+  }
+  if (m->start < m->end) {
+    __num_modules__++;
+  }
+  return 0;
+}
+
+static struct module_range *__find_module__(unsigned long pc) {
+  for (int i = 0; i < __num_modules__; i++) {
+    if (pc >= __modules__[i].start && pc < __modules__[i].end) {
+      return &__modules__[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * The innermost CRASH_FRAMES frames outside libc and the runtime, as
+ * offsets in their module so that they do not depend on where it is loaded
+ * (workers, fork server restarts). The fuzzer hashes them into the crash
+ * signature. backtrace was primed at init.
+ */
+static void __crash_frames__(struct crash_report *report) {
+  void *frames[64];
+  int n = backtrace(frames, 64);
+  unsigned int used = 0;
+  for (int i = 0; i < n && used < CRASH_FRAMES; i++) {
+    unsigned long pc = (unsigned long)frames[i];
+    struct module_range *m = __find_module__(pc);
+    if (m && m->skip) {
+      continue;
+    }
+    report->frames[used++] =
+        m ? (unsigned long long)(m - __modules__) << 48 | (pc - m->base) : pc;
+  }
+  report->num_frames = used;
+}
+
+static void __crash_record__(int sig) {
+  struct crash_report *report = __crash_report__();
+  report->kind = CRASH_SIGNAL;
+  report->signal = sig;
+  __crash_frames__(report);
+}
+
+/*
+ * Installed with SA_RESETHAND: once the report is written the signal, raised
+ * again, kills the process as it would have without the handler.
+ */
+static void __crash_signal__(int sig) {
+  __crash_record__(sig);
+  raise(sig);
+}
+
+static const int __crash_signals__[] = {SIGSEGV, SIGFPE, SIGBUS, SIGILL, SIGABRT};
+
+/* Once, inherited by every child of the fork server */
+static void __crash_handlers_init__(void) {
+  /* Stack overflows need a stack of their own to be reported */
+  static char altstack[1 << 16];
+  stack_t stack = {altstack, 0, sizeof(altstack)};
+  sigaltstack(&stack, NULL);
+
+  dl_iterate_phdr(__add_module__, NULL);
+  struct module_range *m = __find_module__((unsigned long)__crash_signal__);
+  if (m) {
+    m->skip = 1;
+  }
+  m = __find_module__((unsigned long)abort);
+  if (m) {
+    m->skip = 1;
+  }
+  /* The first backtrace loads the unwinder, better not in a crashing process */
+  void *frame;
+  backtrace(&frame, 1);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = __crash_signal__;
+  action.sa_flags = SA_RESETHAND | SA_ONSTACK;
+  for (size_t i = 0; i < sizeof(__crash_signals__) / sizeof(__crash_signals__[0]); i++) {
+    sigaction(__crash_signals__[i], &action, NULL);
+  }
+}
+
+__attribute__((constructor)) void __cov_map_init__(void) {
+  char *id = getenv(SHM_ENV_VAR);
+  if (!id) {
+    return;
+  }
+  void *map = shmat(atoi(id), NULL, 0);
+  if (map != (void *)-1) {
+    __cov_area_ptr__ = map;
+    __crash_handlers_init__();
+  }
+}
+
+/*
+ * Comparison operands logged by the -cmplog instrumentation, one row of
+ * CMP_MAP_H entries per comparison site. Only attached under the fuzzer,
+ * which sets enabled for the runs of its input-to-state stage.
+ */
+struct cmp_header {
+  unsigned int hits;
+  unsigned char type;
+  /* Operand bytes: integer width, or compared length of a buffer */
+  unsigned char size;
+  unsigned char pad[2];
+};
+
+struct cmp_operands {
+  unsigned long long v0;
+  unsigned long long v1;
+};
+
+struct cmp_rtn_operands {
+  unsigned char v0[CMP_RTN_LEN];
+  unsigned char v1[CMP_RTN_LEN];
+};
+
+struct cmp_map {
+  unsigned int enabled;
+  struct cmp_header headers[CMP_MAP_W];
+  union {
+    struct cmp_operands ins;
+    struct cmp_rtn_operands rtn;
+  } log[CMP_MAP_W][CMP_MAP_H];
+};
+
+struct cmp_map *__cmplog_ptr__;
+/* Checked inline before every hook, the enabled field once attached */
+static unsigned int __cmplog_disabled__ = 0;
+unsigned int *__cmplog_enabled_ptr__ = &__cmplog_disabled__;
+
+__attribute__((constructor)) void __cmplog_map_init__(void) {
+  char *id = getenv(CMPLOG_ENV_VAR);
+  if (!id) {
+    return;
+  }
+  void *map = shmat(atoi(id), NULL, 0);
+  if (map != (void *)-1) {
+    __cmplog_ptr__ = map;
+    __cmplog_enabled_ptr__ = &__cmplog_ptr__->enabled;
+  }
+}
+
+void __cmplog_ins__(unsigned long long v0, unsigned long long v1, unsigned int size,
+                    unsigned int id) {
+  if (!__cmplog_ptr__ || !__cmplog_ptr__->enabled) {
+    return;
+  }
+  struct cmp_header *h = &__cmplog_ptr__->headers[id];
+  unsigned int k = h->hits++ % CMP_MAP_H;
+  h->type = CMP_TYPE_INS;
+  h->size = size;
+  __cmplog_ptr__->log[id][k].ins.v0 = v0;
+  __cmplog_ptr__->log[id][k].ins.v1 = v1;
+}
+
+/*
+ * len is (unsigned)-1 for strcmp. Buffers of the str* calls (strings set)
+ * end at their NUL, only memcmp's are read for len bytes whatever they hold.
+ */
+void __cmplog_rtn__(const char *p0, const char *p1, unsigned long long len, unsigned int strings,
+                    unsigned int id) {
+  if (!__cmplog_ptr__ || !__cmplog_ptr__->enabled || !p0 || !p1) {
+    return;
+  }
+  unsigned int n0 = len < CMP_RTN_LEN ? len : CMP_RTN_LEN;
+  unsigned int n1 = n0;
+  if (strings) {
+    /* Never read past the terminator of either string */
+    n0 = strnlen(p0, n0);
+    n1 = strnlen(p1, n1);
+  }
+  struct cmp_header *h = &__cmplog_ptr__->headers[id];
+  unsigned int k = h->hits++ % CMP_MAP_H;
+  h->type = CMP_TYPE_RTN;
+  h->size = n0 > n1 ? n0 : n1;
+  struct cmp_rtn_operands *ops = &__cmplog_ptr__->log[id][k].rtn;
+  memset(ops, 0, sizeof(*ops));
+  memcpy(ops->v0, p0, n0);
+  memcpy(ops->v1, p1, n1);
+}
+
+/* Set while the fuzzer runs the target in-process, see __persistent_run__ */
+static volatile int __persistent_mode__ = 0;
+static sigjmp_buf __persistent_env__;
+static volatile int __persistent_status__;
+
+/* End the current run with a wait status, back in __persistent_run__ */
+static void __persistent_end__(int status) {
+  __persistent_status__ = status;
+  siglongjmp(__persistent_env__, 1);
+}
 
 void __sanitize__(int divisor, int line, int col) {
   if (divisor == 0) {
+    struct crash_report *report = __crash_report__();
+    report->kind = CRASH_SANITIZER;
+    report->line = line;
+    report->col = col;
+    if (__persistent_mode__) {
+      /* Same status as exit(1), without tearing down the fuzzer */
+      __persistent_end__(1 << 8);
+    }
     printf("Divide-by-zero detected at line %d and col %d\n", line, col);
     exit(1);
   }
 }
 
-void __coverage__(int line, int col) {
+/* Map slot of a source location, must match locationId in Instrument.cpp */
+static unsigned int __cov_location_id__(int line, int col) {
+  unsigned int key = ((unsigned int)line << 12) ^ (unsigned int)col;
+  return (key * 2654435761u) >> (32 - MAP_SIZE_POW2);
+}
+
+/* Path of the running executable followed by suffix */
+static void __exe_path__(char *path, const char *suffix) {
   char exe[1024];
   int ret = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
   if (ret == -1) {
@@ -19,12 +316,171 @@ void __coverage__(int line, int col) {
   }
   exe[ret] = 0;
 
-  char logfile[1024];
   int len = strlen(exe);
-  strncpy(logfile, exe, len);
-  logfile[len] = 0;
-  strcat(logfile, ".cov");
+  strncpy(path, exe, len);
+  path[len] = 0;
+  strcat(path, suffix);
+}
+
+/*
+ * Targets built before inline instrumentation still call this. Under the
+ * fuzzer it hits the shared map, otherwise it logs to <exe>.cov.
+ */
+void __coverage__(int line, int col) {
+  if (__cov_area_ptr__ != __cov_initial__) {
+    unsigned char *counter = &__cov_area_ptr__[__cov_location_id__(line, col)];
+    if (*counter != 255) {
+      (*counter)++;
+    }
+    return;
+  }
+  char logfile[1024];
+  __exe_path__(logfile, ".cov");
   FILE *f = fopen(logfile, "a");
   fprintf(f, "%d,%d\n", line, col);
   fclose(f);
 }
+
+/*
+ * Outside the fuzzer, report the covered locations to <exe>.cov through
+ * the <exe>.covmap sidecar written by the Instrument pass.
+ */
+__attribute__((destructor)) void __cov_map_dump__(void) {
+  if (__cov_area_ptr__ != __cov_initial__) {
+    return;
+  }
+  char mapfile[1024];
+  __exe_path__(mapfile, ".covmap");
+  FILE *map = fopen(mapfile, "r");
+  if (!map) {
+    return;
+  }
+  char logfile[1024];
+  __exe_path__(logfile, ".cov");
+  FILE *f = fopen(logfile, "a");
+  unsigned int id;
+  int line, col;
+  while (fscanf(map, "%u,%d,%d\n", &id, &line, &col) == 3) {
+    if (id < MAP_SIZE && __cov_initial__[id]) {
+      fprintf(f, "%d,%d\n", line, col);
+    }
+  }
+  fclose(f);
+  fclose(map);
+}
+
+/*
+ * Fork server, called by the instrumentation at the entry of main.
+ * All messages are 4-byte ints:
+ *   server -> fuzzer: hello, once
+ *   fuzzer -> server: go, once per input
+ *   server -> fuzzer: pid of the forked child, then its wait status
+ * Returns in every forked child, which then runs main on the current input.
+ * Returns immediately when the target is not run by the fuzzer.
+ */
+void __fork_server__(void) {
+  static int started = 0;
+  int msg = 0;
+  if (started || __persistent_mode__) {
+    return;
+  }
+  started = 1;
+
+  /* The status pipe is only open when the fuzzer spawned us */
+  if (write(FORKSRV_FD + 1, &msg, 4) != 4) {
+    return;
+  }
+
+  while (1) {
+    if (read(FORKSRV_FD, &msg, 4) != 4) {
+      _exit(0);
+    }
+    pid_t child = fork();
+    if (child < 0) {
+      _exit(1);
+    }
+    if (child == 0) {
+      close(FORKSRV_FD);
+      close(FORKSRV_FD + 1);
+      return;
+    }
+    int status;
+    if (write(FORKSRV_FD + 1, &child, 4) != 4) {
+      _exit(1);
+    }
+    if (waitpid(child, &status, 0) < 0) {
+      _exit(1);
+    }
+    if (write(FORKSRV_FD + 1, &status, 4) != 4) {
+      _exit(1);
+    }
+  }
+}
+
+static void __persistent_signal__(int sig) {
+  if (!__persistent_mode__) {
+    /* Not the target's fault, crash as usual */
+    signal(sig, SIG_DFL);
+    raise(sig);
+    return;
+  }
+  __crash_record__(sig);
+  __persistent_end__(sig);
+}
+
+/*
+ * Run by exit() in the target ahead of the hooks registered before it (the
+ * fuzzer's), which are never reached. Ends the run with the exit status.
+ * By then exit() has run the thread's TLS destructors, and the atexit and
+ * on_exit handlers the target registered after the hook was armed. They
+ * run on every run that calls exit(), and are gone for the runs after it.
+ */
+static volatile int __persistent_exit_armed__ = 0;
+
+static void __persistent_exit__(int status, void *arg) {
+  (void)arg;
+  __persistent_exit_armed__ = 0;
+  if (__persistent_mode__) {
+    __persistent_end__((status & 0xff) << 8);
+  }
+}
+
+/*
+ * Persistent mode entry, called by the fuzzer once per input on the target
+ * loaded with dlopen. Serves data as stdin and returns a wait status:
+ * the exit code of entry or exit(), 1 for a sanitizer report or the
+ * crashing signal. Globals of the target are not reset between runs.
+ */
+int __persistent_run__(int (*entry)(void), const char *data, unsigned long size) {
+  static int installed = 0;
+  static FILE *devnull;
+  if (!installed) {
+    for (size_t i = 0; i < sizeof(__crash_signals__) / sizeof(__crash_signals__[0]); i++) {
+      signal(__crash_signals__[i], __persistent_signal__);
+    }
+    devnull = fopen("/dev/null", "r+");
+    installed = 1;
+  }
+
+  FILE *input = size ? fmemopen((void *)data, size, "r") : fopen("/dev/null", "r");
+  FILE *saved_stdin = stdin;
+  FILE *saved_stdout = stdout;
+  stdin = input;
+  stdout = devnull;
+  /* An exit() consumed the hook, it is registered again */
+  if (!__persistent_exit_armed__) {
+    __persistent_exit_armed__ = on_exit(__persistent_exit__, NULL) == 0;
+  }
+  int status;
+  if (sigsetjmp(__persistent_env__, 1) == 0) {
+    __persistent_mode__ = 1;
+    status = (entry() & 0xff) << 8;
+  } else {
+    status = __persistent_status__;
+  }
+  __persistent_mode__ = 0;
+  stdin = saved_stdin;
+  stdout = saved_stdout;
+  fclose(input);
+  return status;
+}
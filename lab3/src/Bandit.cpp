@@ -0,0 +1,95 @@
+#include <cinttypes>
+
+#include "Bandit.h"
+#include "Checkpoint.h"
+
+// Pending has one bit per arm, so at most 64 arms
+Bandit::Bandit(int NumArms)
+    : Uses(NumArms), Finds(NumArms), Crashes(NumArms), Prob(NumArms, 1.0 / NumArms),
+      NumArms(NumArms), RecentUses(NumArms), RecentFinds(NumArms), Pending(0),
+      NumRewards(0) {}
+
+int Bandit::pick(Random &Rng) {
+  double U = Rng.real();
+  int Arm = 0;
+  for (; Arm < NumArms - 1; Arm++) {
+    U -= Prob[Arm];
+    if (U < 0) {
+      break;
+    }
+  }
+  Pending |= 1ULL << Arm;
+  return Arm;
+}
+
+/**
+ * Uses and finds are both counted per execution: an arm picked several
+ * times in the stack of a mutant is used once.
+ */
+void Bandit::reward(bool NewCoverage, bool Crash) {
+  for (int Arm = 0; Arm < NumArms; Arm++) {
+    if (!(Pending >> Arm & 1)) {
+      continue;
+    }
+    Uses[Arm]++;
+    RecentUses[Arm]++;
+    if (NewCoverage || Crash) {
+      RecentFinds[Arm]++;
+      Finds[Arm] += NewCoverage;
+      Crashes[Arm] += Crash;
+    }
+  }
+  Pending = 0;
+  if (++NumRewards % BANDIT_UPDATE_PERIOD == 0) {
+    update();
+  }
+}
+
+/**
+ * Probability matching on the decayed find rates, with a floor.
+ */
+void Bandit::update() {
+  double Rate[64];
+  double Total = 0;
+  for (int Arm = 0; Arm < NumArms; Arm++) {
+    // The prior keeps rarely used arms from looking perfect or useless
+    Rate[Arm] = (RecentFinds[Arm] + 0.5) / (RecentUses[Arm] + 1);
+    Total += Rate[Arm];
+    RecentUses[Arm] *= BANDIT_DECAY;
+    RecentFinds[Arm] *= BANDIT_DECAY;
+  }
+  for (int Arm = 0; Arm < NumArms; Arm++) {
+    Prob[Arm] = BANDIT_MIN_PROB + (1 - NumArms * BANDIT_MIN_PROB) * Rate[Arm] / Total;
+  }
+}
+
+void Bandit::print(FILE *F, const char *const *Names) {
+  fprintf(F, "%-16s %12s %10s %10s %12s %8s\n", "arm", "uses", "finds", "crashes",
+          "yield/1M", "prob");
+  for (int Arm = 0; Arm < NumArms; Arm++) {
+    // Finds and crashes per million uses
+    double Efficiency = Uses[Arm] ? 1e6 * (Finds[Arm] + Crashes[Arm]) / Uses[Arm] : 0;
+    fprintf(F, "%-16s %12" PRIu64 " %10" PRIu64 " %10" PRIu64 " %12.1f %8.3f\n", Names[Arm],
+            Uses[Arm], Finds[Arm], Crashes[Arm], Efficiency, Prob[Arm]);
+  }
+}
+
+void Bandit::save(FILE *F) const {
+  writeVector(F, Uses);
+  writeVector(F, Finds);
+  writeVector(F, Crashes);
+  writeVector(F, Prob);
+  writeVector(F, RecentUses);
+  writeVector(F, RecentFinds);
+  writeRaw(F, &NumRewards, 1);
+}
+
+bool Bandit::load(FILE *F) {
+  bool Loaded = readVector(F, Uses) && readVector(F, Finds) && readVector(F, Crashes) &&
+                readVector(F, Prob) && readVector(F, RecentUses) && readVector(F, RecentFinds) &&
+                readRaw(F, &NumRewards, 1);
+  Pending = 0;
+  return Loaded && Prob.size() == (size_t)NumArms && Uses.size() == (size_t)NumArms &&
+         Finds.size() == (size_t)NumArms && Crashes.size() == (size_t)NumArms &&
+         RecentUses.size() == (size_t)NumArms && RecentFinds.size() == (size_t)NumArms;
+}
@@ -0,0 +1,492 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "CorpusStore.h"
+#include "Coverage.h"
+#include "Mutator.h"
+#include "Random.h"
+#include "Scheduler.h"
+#include "Utils.h"
+
+/*
+ * Micro benchmarks for the fuzzer building blocks.
+ * usage: bench exec [exe file] [input file] [iterations]
+ *        bench coverage
+ *        bench mutate [seed file]
+ *        bench random
+ *        bench classify
+ *        bench store [directory] [inputs]
+ *        bench input [iterations]
+ *        bench partner
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+// Heap allocations so far, counted by the global operator new below
+static long NumAllocs = 0;
+
+void *operator new(size_t Size) {
+  NumAllocs++;
+  if (void *Ptr = malloc(Size ? Size : 1)) {
+    return Ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *Ptr) noexcept { free(Ptr); }
+void operator delete(void *Ptr, size_t) noexcept { free(Ptr); }
+
+// Read back from every buffer a benchmark fills, so that filling it is not optimized away
+static volatile uint8_t Sink;
+
+static double secondsSince(Clock::time_point Start) {
+  return std::chrono::duration<double>(Clock::now() - Start).count();
+}
+
+/**
+ * Execs/sec of a process per execution against the fork server on the same input.
+ */
+int benchExec(std::string &Target, std::string &Input, int Iterations) {
+  auto Start = Clock::now();
+  for (int i = 0; i < Iterations; i++) {
+    runTargetSpawn(Target, Input);
+  }
+  double Spawn = Iterations / secondsSince(Start);
+  printf("%-12s %10.1f execs/sec\n", "spawn", Spawn);
+
+  if (!startForkServer(Target)) {
+    fprintf(stderr, "%s has no fork server\n", Target.c_str());
+    return 1;
+  }
+  Start = Clock::now();
+  for (int i = 0; i < Iterations; i++) {
+    runTargetForkServer(Input);
+  }
+  double ForkServer = Iterations / secondsSince(Start);
+  printf("%-12s %10.1f execs/sec (%.1fx)\n", "forkserver", ForkServer,
+         ForkServer / Spawn);
+  return 0;
+}
+
+/**
+ * Cost of checking one execution's .cov file (1000 already known lines)
+ * as the known coverage grows, linear search against CoverageSet.
+ */
+int benchCoverage() {
+  const int LinesPerExec = 1000;
+  printf("%-8s %16s %16s\n", "points", "find us/exec", "set us/exec");
+  for (int Points = 1000; Points <= 100000; Points *= 10) {
+    std::vector<std::string> Lines, Known;
+    CoverageSet Set;
+    for (int i = 0; i < Points; i++) {
+      std::string Line = std::to_string(i / 8 + 1) + "," + std::to_string(i % 8 + 1);
+      Known.push_back(Line);
+      Set.insert(coverageKey(Line));
+      if (i % (Points / LinesPerExec) == 0) {
+        Lines.push_back(Line);
+      }
+    }
+
+    int Execs = std::max(1, 10000000 / (Points * LinesPerExec / 100));
+    auto Start = Clock::now();
+    volatile int Hits = 0;
+    for (int e = 0; e < Execs; e++) {
+      for (auto &Line : Lines) {
+        Hits += std::find(Known.begin(), Known.end(), Line) != Known.end();
+      }
+    }
+    double Find = secondsSince(Start) * 1e6 / Execs;
+
+    Execs = 1000;
+    Start = Clock::now();
+    for (int e = 0; e < Execs; e++) {
+      for (auto &Line : Lines) {
+        Hits += !Set.insert(coverageKey(Line));
+      }
+    }
+    double Hash = secondsSince(Start) * 1e6 / Execs;
+    printf("%-8d %16.1f %16.1f\n", Points, Find, Hash);
+  }
+  return 0;
+}
+
+/**
+ * Mutations/sec and heap allocations per mutant of havoc on Seed, copying
+ * the seed by value per mutant against reusing one mutation buffer.
+ */
+int benchMutate(const std::string &Seed) {
+  const int Mutants = 20000;
+  printf("%-10s %14s %14s\n", "buffer", "mutants/sec", "allocs/mutant");
+
+  Random Rng(0);
+  long Allocs = NumAllocs;
+  auto Start = Clock::now();
+  volatile size_t Bytes = 0;
+  for (int i = 0; i < Mutants; i++) {
+    std::string Mutant = Seed;
+    mutateHavoc(Mutant, Rng);
+    Bytes += Mutant.size();
+  }
+  printf("%-10s %14.0f %14.2f\n", "copy", Mutants / secondsSince(Start),
+         (double)(NumAllocs - Allocs) / Mutants);
+
+  Rng.seed(0);
+  std::string Mutant;
+  initMutationBuffer(Mutant);
+  Allocs = NumAllocs;
+  Start = Clock::now();
+  for (int i = 0; i < Mutants; i++) {
+    Mutant.assign(Seed);
+    mutateHavoc(Mutant, Rng);
+    Bytes += Mutant.size();
+  }
+  printf("%-10s %14.0f %14.2f\n", "reused", Mutants / secondsSince(Start),
+         (double)(NumAllocs - Allocs) / Mutants);
+  return 0;
+}
+
+/**
+ * Per-execution cost of bucketing the hit counts and checking them against
+ * the virgin map, as the number of map entries an execution hits grows.
+ * The map reset and the writes of the execution itself are timed apart.
+ */
+int benchClassify() {
+  const int Execs = 20000;
+  initCoverageMap();
+  initVirginMap(false);
+  Random Rng(0);
+  printf("%-8s %16s %16s\n", "entries", "reset ns/exec", "classify ns/exec");
+  for (int Entries = 100; Entries <= 10000; Entries *= 10) {
+    std::vector<uint32_t> Hit(Entries);
+    for (auto &Entry : Hit) {
+      Entry = Rng.below(MAP_SIZE);
+    }
+    auto Start = Clock::now();
+    for (int e = 0; e < Execs; e++) {
+      resetCoverageMap();
+      for (uint32_t Entry : Hit) {
+        TraceBits[Entry] += e % 7 + 1;
+      }
+    }
+    double Reset = secondsSince(Start) * 1e9 / Execs;
+
+    Start = Clock::now();
+    volatile int New = 0;
+    for (int e = 0; e < Execs; e++) {
+      resetCoverageMap();
+      for (uint32_t Entry : Hit) {
+        TraceBits[Entry] += e % 7 + 1;
+      }
+      classifyCounts(TraceBits);
+      New += hasNewCoverage(VirginBits);
+    }
+    double Classify = secondsSince(Start) * 1e9 / Execs - Reset;
+    printf("%-8d %16.0f %16.0f\n", Entries, Reset, Classify);
+  }
+  return 0;
+}
+
+/**
+ * Random bytes/sec from rand(), Random::below and Random::fill.
+ */
+int benchRandom() {
+  const size_t Len = 1 << 16;
+  const int Rounds = 1000;
+  std::vector<uint8_t> Buf(Len);
+  Random Rng(0);
+
+  srand(0);
+  auto Start = Clock::now();
+  for (int r = 0; r < Rounds; r++) {
+    for (size_t i = 0; i < Len; i++) {
+      Buf[i] = rand() % 256;
+    }
+    // At an index the compiler cannot know, any byte may be read
+    Sink ^= Buf[(r + Sink) % Len];
+  }
+  double Rand = Len * Rounds / secondsSince(Start) / 1e6;
+  printf("%-8s %10.1f MB/sec\n", "rand", Rand);
+
+  Start = Clock::now();
+  for (int r = 0; r < Rounds; r++) {
+    for (size_t i = 0; i < Len; i++) {
+      Buf[i] = Rng.below(256);
+    }
+    Sink ^= Buf[(r + Sink) % Len];
+  }
+  double Below = Len * Rounds / secondsSince(Start) / 1e6;
+  printf("%-8s %10.1f MB/sec (%.1fx)\n", "below", Below, Below / Rand);
+
+  Start = Clock::now();
+  for (int r = 0; r < Rounds; r++) {
+    Rng.fill(Buf.data(), Len);
+    Sink ^= Buf[(r + Sink) % Len];
+  }
+  double Fill = Len * Rounds / secondsSince(Start) / 1e6;
+  printf("%-8s %10.1f MB/sec (%.1fx)\n", "fill", Fill, Fill / Rand);
+  return 0;
+}
+
+/**
+ * Storing inputs as a file each, as the fuzzer used to, against appending
+ * them to a pack, then loading them all back: directory listing and a read
+ * per file, against mapping the pack.
+ */
+int benchStore(const std::string &Dir, int NumInputs) {
+  Random Rng(0);
+  std::vector<std::string> Inputs(NumInputs);
+  size_t Bytes = 0;
+  for (auto &Input : Inputs) {
+    Input.resize(1 + Rng.below(256));
+    Rng.fill((uint8_t *)&Input[0], Input.size());
+    Bytes += Input.size();
+  }
+  std::string FileDir = Dir + "/bench_files", Base = Dir + "/bench_pack";
+  mkdir(FileDir.c_str(), 0755);
+
+  auto Start = Clock::now();
+  for (int i = 0; i < NumInputs; i++) {
+    std::ofstream OutFile(FileDir + "/input" + std::to_string(i));
+    OutFile << Inputs[i];
+  }
+  double Files = NumInputs / secondsSince(Start);
+  printf("%-12s %10.0f inputs/sec written\n", "files", Files);
+
+  Start = Clock::now();
+  {
+    PackWriter Pack;
+    Pack.open(Base, false);
+    for (int i = 0; i < NumInputs; i++) {
+      Pack.append(Inputs[i], i);
+    }
+  }
+  double Packed = NumInputs / secondsSince(Start);
+  printf("%-12s %10.0f inputs/sec written (%.1fx)\n", "pack", Packed, Packed / Files);
+
+  size_t Loaded = 0;
+  Start = Clock::now();
+  DIR *Directory = opendir(FileDir.c_str());
+  while (struct dirent *Ent = readdir(Directory)) {
+    if (Ent->d_type == DT_REG) {
+      std::string Path = FileDir + "/" + Ent->d_name;
+      Loaded += readOneFile(Path).size();
+    }
+  }
+  closedir(Directory);
+  double FilesLoad = secondsSince(Start);
+  printf("%-12s %10.1f ms to load %zu bytes\n", "files", FilesLoad * 1e3, Loaded);
+
+  Loaded = 0;
+  uint64_t Sum = 0;
+  Start = Clock::now();
+  {
+    PackReader Pack;
+    Pack.open(Base);
+    // Every byte touched, as a reader would
+    for (size_t i = 0; i < Pack.size(); i++) {
+      const char *Data = Pack.data(i);
+      for (uint32_t j = 0; j < Pack.entry(i).Size; j++) {
+        Sum += Data[j];
+      }
+      Loaded += Pack.entry(i).Size;
+    }
+  }
+  double PackLoad = secondsSince(Start);
+  printf("%-12s %10.1f ms to load %zu bytes (%.1fx)\n", "pack", PackLoad * 1e3, Loaded,
+         FilesLoad / PackLoad);
+
+  for (int i = 0; i < NumInputs; i++) {
+    unlink((FileDir + "/input" + std::to_string(i)).c_str());
+  }
+  rmdir(FileDir.c_str());
+  unlink((Base + ".pack").c_str());
+  unlink((Base + ".idx").c_str());
+  // Sum keeps the reads
+  Sink ^= Sum;
+  return Loaded != Bytes;
+}
+
+/**
+ * Delivering an input to the stdin of a child that reads it all, per channel:
+ * a pipe the parent writes through, the temp file truncated and written
+ * again as the fuzzer used to, and the memfd written over in place that it
+ * uses now. The child is woken through a pipe for each input, and tells
+ * the parent through another one once it has read it all.
+ */
+enum InputChannel { CHANNEL_PIPE, CHANNEL_FILE, CHANNEL_MEMFD };
+
+static double deliverInputs(InputChannel Channel, const std::string &Input, int Iterations) {
+  int Fds[2] = {-1, -1}, Go[2], Done[2];
+  if (Channel == CHANNEL_PIPE) {
+    pipe(Fds);
+  } else if (Channel == CHANNEL_FILE) {
+    char Path[] = "/tmp/.bench_input_XXXXXX";
+    Fds[0] = Fds[1] = mkstemp(Path);
+    unlink(Path);
+  } else {
+    Fds[0] = Fds[1] = memfd_create("bench_input", 0);
+  }
+  if (Fds[0] < 0 || pipe(Go) || pipe(Done)) {
+    perror("deliverInputs");
+    exit(1);
+  }
+  pid_t Pid = fork();
+  if (Pid == 0) {
+    std::vector<char> Buffer(1 << 16);
+    char Byte;
+    for (int i = 0; i < Iterations; i++) {
+      if (read(Go[0], &Byte, 1) != 1) {
+        _exit(1);
+      }
+      for (size_t Read = 0; Read < Input.size();) {
+        ssize_t Got = read(Fds[0], Buffer.data(), Buffer.size());
+        if (Got <= 0) {
+          _exit(1);
+        }
+        Read += Got;
+      }
+      write(Done[1], &Byte, 1);
+    }
+    _exit(0);
+  }
+
+  auto Start = Clock::now();
+  char Byte = 0;
+  for (int i = 0; i < Iterations; i++) {
+    if (Channel == CHANNEL_PIPE) {
+      // Woken first, a large input does not fit in the pipe
+      write(Go[1], &Byte, 1);
+      for (size_t Written = 0; Written < Input.size();) {
+        Written += write(Fds[1], Input.data() + Written, Input.size() - Written);
+      }
+    } else {
+      if (Channel == CHANNEL_FILE) {
+        ftruncate(Fds[1], 0);
+      }
+      pwrite(Fds[1], Input.data(), Input.size(), 0);
+      lseek(Fds[1], 0, SEEK_SET);
+      write(Go[1], &Byte, 1);
+    }
+    read(Done[0], &Byte, 1);
+  }
+  double Seconds = secondsSince(Start);
+  waitpid(Pid, NULL, 0);
+  close(Fds[0]);
+  if (Channel == CHANNEL_PIPE) {
+    close(Fds[1]);
+  }
+  for (int Fd : {Go[0], Go[1], Done[0], Done[1]}) {
+    close(Fd);
+  }
+  return Iterations / Seconds;
+}
+
+int benchInput(int Iterations) {
+  const char *Names[] = {"pipe", "file", "memfd"};
+  printf("%-8s %-6s %14s\n", "size", "", "inputs/sec");
+  for (size_t Size : {(size_t)1 << 10, (size_t)1 << 20}) {
+    std::string Input(Size, '\0');
+    Random Rng(0);
+    Rng.fill((uint8_t *)&Input[0], Input.size());
+    // Fewer of the large ones, for a comparable run time
+    int Count = Size > (1 << 16) ? Iterations / 10 : Iterations;
+    double Pipe = 0;
+    for (InputChannel Channel : {CHANNEL_PIPE, CHANNEL_FILE, CHANNEL_MEMFD}) {
+      double Rate = deliverInputs(Channel, Input, Count);
+      Pipe = Channel == CHANNEL_PIPE ? Rate : Pipe;
+      printf("%-8zu %-6s %14.0f (%.2fx)\n", Size, Names[Channel], Rate, Rate / Pipe);
+    }
+  }
+  return 0;
+}
+
+/**
+ * Whether splice partners are told apart by coverage: two families of
+ * seeds with disjoint edges, each seed sharing most of its edges with its
+ * family. Picked at random, the partner would be from the other family
+ * about half of the time. Fails under PARTNER_MIN_SHARE percent, at any
+ * number of edges per seed.
+ */
+#define PARTNER_MIN_SHARE 90
+
+int benchPartner() {
+  const int Seeds = 100, Picks = 10000;
+  printf("%-8s %16s\n", "tuples", "other family %");
+  bool Failed = false;
+  for (uint32_t NumTuples : {10, 100, 1000, 5000}) {
+    Scheduler Sched(SCHEDULE_EXPLORE);
+    for (int Seed = 0; Seed < Seeds; Seed++) {
+      // Even seeds in the low half of the map, odd ones in the high half,
+      // one tuple in ten their own
+      uint32_t Base = Seed % 2 * MAP_SIZE / 2;
+      uint32_t Own = Base + NumTuples + Seed / 2 * (NumTuples / 10 + 1);
+      std::vector<uint32_t> Tuples;
+      for (uint32_t t = 0; t < NumTuples; t++) {
+        Tuples.push_back((t % 10 ? Base + t : Own + t / 10) << TUPLE_BITS);
+      }
+      Sched.addSeed(100, 100, std::move(Tuples));
+    }
+    Random Rng(0);
+    int Other = 0;
+    for (int i = 0; i < Picks; i++) {
+      size_t Current = Sched.next(Rng);
+      Other += Sched.partner(Rng) % 2 != Current % 2;
+    }
+    double Share = Other * 100.0 / Picks;
+    printf("%-8u %16.1f\n", NumTuples, Share);
+    Failed |= Share < PARTNER_MIN_SHARE;
+  }
+  return Failed;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && !strcmp(argv[1], "random")) {
+    return benchRandom();
+  }
+  if (argc > 1 && !strcmp(argv[1], "classify")) {
+    return benchClassify();
+  }
+  if (argc > 1 && !strcmp(argv[1], "coverage")) {
+    return benchCoverage();
+  }
+  if (argc > 1 && !strcmp(argv[1], "input")) {
+    return benchInput(argc > 2 ? strtol(argv[2], NULL, 10) : 10000);
+  }
+  if (argc > 1 && !strcmp(argv[1], "partner")) {
+    return benchPartner();
+  }
+  if (argc > 2 && !strcmp(argv[1], "store")) {
+    return benchStore(argv[2], argc > 3 ? strtol(argv[3], NULL, 10) : 100000);
+  }
+  if (argc > 2 && !strcmp(argv[1], "mutate")) {
+    std::string Path(argv[2]);
+    return benchMutate(readOneFile(Path));
+  }
+  if (argc < 4 || strcmp(argv[1], "exec")) {
+    printf("usage %s exec [exe file] [input file] [iterations (optional arg)]\n"
+           "      %s coverage\n"
+           "      %s mutate [seed file]\n"
+           "      %s random\n"
+           "      %s classify\n"
+           "      %s store [directory] [inputs (optional arg)]\n"
+           "      %s input [iterations (optional arg)]\n"
+           "      %s partner\n",
+           argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+    return 1;
+  }
+  std::string Target(argv[2]);
+  std::string Path(argv[3]);
+  std::string Input = readOneFile(Path);
+  int Iterations = argc > 4 ? strtol(argv[4], NULL, 10) : 1000;
+  return benchExec(Target, Input, Iterations);
+}
@@ -0,0 +1,222 @@
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Checkpoint.h"
+#include "Scheduler.h"
+
+enum RecordType { RECORD_SEED = 1, RECORD_PROGRESS };
+
+// Every journal record starts with its type and the size of what follows
+struct RecordHeader {
+  uint32_t Type;
+  uint32_t Size;
+};
+
+// Followed by the tuples and the input
+struct SeedRecord {
+  uint64_t ExecUs;
+  uint32_t NumTuples;
+  uint32_t InputSize;
+};
+
+// Followed by the effector map of the deterministic stage
+struct ProgressRecord {
+  uint32_t Index;
+  uint32_t TimesFuzzed;
+  uint32_t NumChildren;
+  uint8_t CmpLogDone;
+  uint8_t DetStage;
+  uint8_t DetStarted;
+  uint8_t Pad;
+  uint32_t DetPos;
+  uint32_t DetStep;
+  uint32_t DetVisit;
+  uint64_t DetSeedHash;
+  uint32_t EffectorSize;
+};
+
+struct SnapshotHeader {
+  uint32_t Magic;
+  uint32_t Version;
+  uint64_t JournalBytes;
+  uint64_t NumSeeds;
+};
+
+Checkpoint::Checkpoint() : Journal(NULL), JournalBytes(0), NumSaved(0) {}
+
+Checkpoint::~Checkpoint() {
+  if (Journal) {
+    fclose(Journal);
+  }
+}
+
+void Checkpoint::open(const std::string &OutDir, const std::string &Suffix) {
+  JournalPath = OutDir + "/checkpoint_seeds" + Suffix;
+  SnapshotPath = OutDir + "/checkpoint" + Suffix;
+}
+
+bool Checkpoint::exists() const {
+  struct stat Buffer;
+  return !stat(SnapshotPath.c_str(), &Buffer);
+}
+
+static void appendSeed(FILE *F, const std::string &Input, const SeedInfo &Seed) {
+  SeedRecord Record = {Seed.ExecUs, (uint32_t)Seed.Tuples.size(), (uint32_t)Input.size()};
+  RecordHeader Header = {RECORD_SEED, (uint32_t)(sizeof(Record) + Record.NumTuples * 4 +
+                                                 Record.InputSize)};
+  writeRaw(F, &Header, 1);
+  writeRaw(F, &Record, 1);
+  writeRaw(F, Seed.Tuples.data(), Seed.Tuples.size());
+  writeRaw(F, Input.data(), Input.size());
+}
+
+static void appendProgress(FILE *F, uint32_t Index, const SeedInfo &Seed) {
+  const DetProgress &Det = Seed.Det;
+  ProgressRecord Record = {Index,         Seed.TimesFuzzed, Seed.NumChildren, Seed.CmpLogDone,
+                           Det.Stage,     Det.Started,      0,                Det.Pos,
+                           Det.Step,      Det.Visit,        Det.SeedHash,
+                           (uint32_t)Det.Effector.size()};
+  RecordHeader Header = {RECORD_PROGRESS, (uint32_t)(sizeof(Record) + Record.EffectorSize)};
+  writeRaw(F, &Header, 1);
+  writeRaw(F, &Record, 1);
+  writeRaw(F, Det.Effector.data(), Det.Effector.size());
+}
+
+FILE *Checkpoint::begin(const std::vector<std::string> &Inputs, const Scheduler &Sched) {
+  if (!Journal) {
+    // A new campaign, whatever was checkpointed here before is gone
+    unlink(SnapshotPath.c_str());
+    Journal = fopen(JournalPath.c_str(), "wb");
+    if (!Journal) {
+      perror(JournalPath.c_str());
+      return NULL;
+    }
+  }
+  for (; NumSaved < Sched.Seeds.size(); NumSaved++) {
+    appendSeed(Journal, Inputs[NumSaved], Sched.Seeds[NumSaved]);
+  }
+  for (uint32_t Index : TouchedList) {
+    appendProgress(Journal, Index, Sched.Seeds[Index]);
+    Touched[Index] = false;
+  }
+  TouchedList.clear();
+  if (fflush(Journal) || fdatasync(fileno(Journal))) {
+    perror(JournalPath.c_str());
+    return NULL;
+  }
+  JournalBytes = ftell(Journal);
+
+  std::string Temp = SnapshotPath + ".tmp";
+  FILE *Snapshot = fopen(Temp.c_str(), "wb");
+  if (!Snapshot) {
+    perror(Temp.c_str());
+    return NULL;
+  }
+  SnapshotHeader Header = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION, JournalBytes, NumSaved};
+  writeRaw(Snapshot, &Header, 1);
+  return Snapshot;
+}
+
+bool Checkpoint::commit(FILE *Snapshot) {
+  bool Written = !ferror(Snapshot) && !fflush(Snapshot) && !fsync(fileno(Snapshot));
+  fclose(Snapshot);
+  std::string Temp = SnapshotPath + ".tmp";
+  if (!Written || rename(Temp.c_str(), SnapshotPath.c_str())) {
+    perror(SnapshotPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+static bool replayProgress(FILE *F, const RecordHeader &Header, Scheduler &Sched) {
+  ProgressRecord Record;
+  if (Header.Size < sizeof(Record) || !readRaw(F, &Record, 1) ||
+      Header.Size != sizeof(Record) + Record.EffectorSize || Record.Index >= Sched.Seeds.size()) {
+    return false;
+  }
+  SeedInfo &Seed = Sched.Seeds[Record.Index];
+  Seed.TimesFuzzed = Record.TimesFuzzed;
+  Seed.NumChildren = Record.NumChildren;
+  Seed.CmpLogDone = Record.CmpLogDone;
+  Seed.Det.Stage = Record.DetStage;
+  Seed.Det.Started = Record.DetStarted;
+  Seed.Det.Pos = Record.DetPos;
+  Seed.Det.Step = Record.DetStep;
+  Seed.Det.Visit = Record.DetVisit;
+  Seed.Det.SeedHash = Record.DetSeedHash;
+  Seed.Det.Effector.resize(Record.EffectorSize);
+  return readRaw(F, Seed.Det.Effector.data(), Record.EffectorSize);
+}
+
+static bool replaySeed(FILE *F, const RecordHeader &Header, std::vector<std::string> &Inputs,
+                       Scheduler &Sched) {
+  SeedRecord Record;
+  if (Header.Size < sizeof(Record) || !readRaw(F, &Record, 1) ||
+      Header.Size != sizeof(Record) + (uint64_t)Record.NumTuples * 4 + Record.InputSize) {
+    return false;
+  }
+  std::vector<uint32_t> Tuples(Record.NumTuples);
+  std::string Input(Record.InputSize, '\0');
+  if (!readRaw(F, Tuples.data(), Tuples.size()) || !readRaw(F, &Input[0], Input.size())) {
+    return false;
+  }
+  Inputs.push_back(std::move(Input));
+  Sched.addSeed(Record.InputSize, Record.ExecUs, std::move(Tuples));
+  return true;
+}
+
+FILE *Checkpoint::restore(std::vector<std::string> &Inputs, Scheduler &Sched) {
+  FILE *Snapshot = fopen(SnapshotPath.c_str(), "rb");
+  if (!Snapshot) {
+    return NULL;
+  }
+  SnapshotHeader Header;
+  if (!readRaw(Snapshot, &Header, 1) || Header.Magic != CHECKPOINT_MAGIC ||
+      Header.Version != CHECKPOINT_VERSION) {
+    fprintf(stderr, "%s: not a checkpoint of this version\n", SnapshotPath.c_str());
+    fclose(Snapshot);
+    return NULL;
+  }
+
+  FILE *F = fopen(JournalPath.c_str(), "rb");
+  if (!F) {
+    perror(JournalPath.c_str());
+    fclose(Snapshot);
+    return NULL;
+  }
+  // Large reads, a corpus of 100k seeds is a few hundred MB of journal
+  static char Buffer[1 << 20];
+  setvbuf(F, Buffer, _IOFBF, sizeof(Buffer));
+  uint64_t Offset = 0;
+  bool Valid = true;
+  while (Valid && Offset < Header.JournalBytes) {
+    RecordHeader Record;
+    Valid = readRaw(F, &Record, 1);
+    if (Valid && Record.Type == RECORD_SEED) {
+      Valid = replaySeed(F, Record, Inputs, Sched);
+    } else if (Valid && Record.Type == RECORD_PROGRESS) {
+      Valid = replayProgress(F, Record, Sched);
+    } else {
+      Valid = false;
+    }
+    Offset += sizeof(Record) + Record.Size;
+  }
+  fclose(F);
+  if (!Valid || Offset != Header.JournalBytes || Inputs.size() != Header.NumSeeds) {
+    fprintf(stderr, "%s: does not match %s\n", JournalPath.c_str(), SnapshotPath.c_str());
+    fclose(Snapshot);
+    return NULL;
+  }
+
+  // Records appended after the snapshot was taken are dropped
+  if (truncate(JournalPath.c_str(), Header.JournalBytes) ||
+      !(Journal = fopen(JournalPath.c_str(), "ab"))) {
+    perror(JournalPath.c_str());
+    fclose(Snapshot);
+    return NULL;
+  }
+  JournalBytes = Header.JournalBytes;
+  NumSaved = Header.NumSeeds;
+  return Snapshot;
+}
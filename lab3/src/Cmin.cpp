@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "Corpus.h"
+#include "CorpusStore.h"
+#include "Coverage.h"
+#include "Utils.h"
+
+/*
+ * Corpus distillation: copy to the output directory a subset of the inputs
+ * that covers every coverage tuple (map entry and hit-count bucket) the whole
+ * set covers, favoring small and fast ones.
+ * Given a fuzzer output directory, its success/ inputs are distilled, read
+ * in place from the packs of its workers if there are any.
+ * usage: cmin [-j workers] [exe file] [input dir] [output dir]
+ */
+
+struct Entry {
+  std::string Name;
+  size_t Size;
+  uint64_t ExecUs;
+  // Read and run, with a trace back from its worker
+  bool Traced;
+  bool Passed;
+  std::vector<uint32_t> Tuples;
+  // In a pack, NULL for a file of the input directory
+  const char *Data;
+};
+
+// False when the input cannot be read
+static bool readInput(std::string &Dir, Entry &E, std::string &Input) {
+  if (E.Data) {
+    Input.assign(E.Data, E.Size);
+    return true;
+  }
+  std::ifstream File(Dir + "/" + E.Name, std::ios::binary);
+  Input.assign(std::istreambuf_iterator<char>(File), std::istreambuf_iterator<char>());
+  return File.is_open() && !File.bad();
+}
+
+static void listInputs(std::string &Dir, std::vector<Entry> &Entries) {
+  DIR *Directory = opendir(Dir.c_str());
+  if (!Directory) {
+    return;
+  }
+  while (struct dirent *Ent = readdir(Directory)) {
+    if (Ent->d_type == DT_REG) {
+      Entries.push_back({Ent->d_name, 0, 0, false, false, {}, NULL});
+    }
+  }
+  closedir(Directory);
+}
+
+/**
+ * Inputs of the success packs of every worker, left mapped until exit.
+ */
+static void listPackedInputs(std::string &OutDir, std::vector<Entry> &Entries) {
+  for (int Worker = 0;; Worker++) {
+    std::string Base = OutDir + "/success";
+    if (Worker > 0) {
+      Base += "." + std::to_string(Worker);
+    }
+    struct stat Buffer;
+    if (stat((Base + ".idx").c_str(), &Buffer)) {
+      return;
+    }
+    PackReader *Pack = new PackReader();
+    Pack->open(Base);
+    for (size_t i = 0; i < Pack->size(); i++) {
+      std::string Name = "input" + std::to_string(Pack->entry(i).Id);
+      Entries.push_back({Name, Pack->entry(i).Size, 0, false, false, {}, Pack->data(i)});
+    }
+  }
+}
+
+/**
+ * Run every NumWorkers-th input from Worker on, writing one record per input
+ * to Out: index, exec us, wait status, number of tuples and the tuples.
+ * Inputs that cannot be read get no record.
+ */
+static void traceInputs(std::string &Target, std::string &Dir, std::vector<Entry> &Entries,
+                        int Worker, int NumWorkers, FILE *Out) {
+  initCoverageMap();
+  std::vector<uint32_t> Tuples;
+  std::string Input;
+  for (size_t i = Worker; i < Entries.size(); i += NumWorkers) {
+    if (!readInput(Dir, Entries[i], Input)) {
+      fprintf(stderr, "Cannot read %s/%s\n", Dir.c_str(), Entries[i].Name.c_str());
+      continue;
+    }
+    resetCoverageMap();
+    auto Start = std::chrono::steady_clock::now();
+    int Status = runTarget(Target, Input);
+    uint64_t ExecUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - Start).count();
+    classifyCounts(TraceBits);
+    Tuples.clear();
+    traceTuples(TraceBits, Tuples);
+    uint32_t Header[2] = {(uint32_t)i, (uint32_t)Tuples.size()};
+    fwrite(Header, sizeof(Header), 1, Out);
+    fwrite(&ExecUs, sizeof(ExecUs), 1, Out);
+    fwrite(&Status, sizeof(Status), 1, Out);
+    fwrite(Tuples.data(), sizeof(uint32_t), Tuples.size(), Out);
+  }
+  fflush(Out);
+}
+
+/**
+ * Records of a worker, up to the first incomplete one (a worker that died
+ * or a full disk): the inputs after it are left untraced.
+ */
+static void readTraces(FILE *In, std::vector<Entry> &Entries) {
+  rewind(In);
+  uint32_t Header[2];
+  while (fread(Header, sizeof(Header), 1, In) == 1 && Header[0] < Entries.size()) {
+    Entry &E = Entries[Header[0]];
+    int Status = 0;
+    E.Tuples.resize(Header[1]);
+    if (fread(&E.ExecUs, sizeof(E.ExecUs), 1, In) != 1 ||
+        fread(&Status, sizeof(Status), 1, In) != 1 ||
+        fread(E.Tuples.data(), sizeof(uint32_t), Header[1], In) != Header[1]) {
+      E.Tuples.clear();
+      return;
+    }
+    E.Traced = true;
+    // Crashes and hangs do not belong in a corpus to fuzz from
+    E.Passed = Status != RUN_TIMEOUT && !WIFSIGNALED(Status) && Status != 256;
+  }
+}
+
+static void report(const char *Label, std::vector<Entry> &Entries, std::vector<size_t> &Indices) {
+  size_t Bytes = 0;
+  uint64_t ExecUs = 0;
+  for (size_t i : Indices) {
+    Bytes += Entries[i].Size;
+    ExecUs += Entries[i].ExecUs;
+  }
+  printf("%-8s %8zu inputs %12zu bytes %10.1f ms exec\n", Label, Indices.size(), Bytes,
+         ExecUs / 1000.0);
+}
+
+int main(int argc, char **argv) {
+  int NumWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+  if (argc > 2 && !strcmp(argv[1], "-j")) {
+    NumWorkers = strtol(argv[2], NULL, 10);
+    argv += 2;
+    argc -= 2;
+  }
+  if (argc < 4) {
+    printf("usage %s [-j workers] [exe file] [input dir or fuzzer output dir] [output dir]\n",
+           argv[0]);
+    return 1;
+  }
+  std::string Target(argv[1]);
+  std::string InDir(argv[2]);
+  std::string OutDir(argv[3]);
+  if (Target.size() > 3 && Target.substr(Target.size() - 3) == ".so") {
+    Target = Target.substr(0, Target.size() - 3);
+  }
+  struct stat Buffer;
+  std::vector<Entry> Entries;
+  if (!stat((InDir + "/success.idx").c_str(), &Buffer)) {
+    listPackedInputs(InDir, Entries);
+  } else {
+    if (!stat((InDir + "/success").c_str(), &Buffer)) {
+      InDir += "/success";
+    }
+    listInputs(InDir, Entries);
+  }
+  if (Entries.empty()) {
+    fprintf(stderr, "No inputs in %s\n", InDir.c_str());
+    return 1;
+  }
+  if (mkdir(OutDir.c_str(), 0755) && errno != EEXIST) {
+    perror(OutDir.c_str());
+    return 1;
+  }
+  for (auto &E : Entries) {
+    if (!E.Data && !stat((InDir + "/" + E.Name).c_str(), &Buffer)) {
+      E.Size = Buffer.st_size;
+    }
+  }
+
+  // One fork server and coverage map per worker, results through a temp file each
+  NumWorkers = std::max(1, std::min<int>(NumWorkers, Entries.size()));
+  std::vector<FILE *> Results(NumWorkers);
+  for (int w = 0; w < NumWorkers; w++) {
+    Results[w] = tmpfile();
+    if (!Results[w]) {
+      perror("tmpfile");
+      return 1;
+    }
+    pid_t Pid = fork();
+    if (Pid < 0) {
+      perror("fork");
+      return 1;
+    }
+    if (Pid == 0) {
+      traceInputs(Target, InDir, Entries, w, NumWorkers, Results[w]);
+      // exit rather than _exit, the coverage map is removed at exit
+      exit(0);
+    }
+  }
+  while (wait(NULL) > 0) {
+  }
+  for (FILE *F : Results) {
+    readTraces(F, Entries);
+    fclose(F);
+  }
+
+  std::vector<size_t> All;
+  std::vector<const std::vector<uint32_t> *> Tuples;
+  std::vector<double> Costs;
+  std::vector<size_t> Passing;
+  size_t NumTraced = 0;
+  for (size_t i = 0; i < Entries.size(); i++) {
+    All.push_back(i);
+    NumTraced += Entries[i].Traced;
+    if (Entries[i].Passed) {
+      Passing.push_back(i);
+      Tuples.push_back(&Entries[i].Tuples);
+      Costs.push_back((double)std::max<size_t>(Entries[i].Size, 1) *
+                      std::max<uint64_t>(Entries[i].ExecUs, 1));
+    }
+  }
+  std::vector<size_t> Kept;
+  for (size_t i : distillCorpus(Tuples, Costs)) {
+    Kept.push_back(Passing[i]);
+  }
+  std::string Input;
+  for (size_t i : Kept) {
+    if (!readInput(InDir, Entries[i], Input)) {
+      fprintf(stderr, "Cannot read %s/%s\n", InDir.c_str(), Entries[i].Name.c_str());
+      continue;
+    }
+    std::ofstream OutFile(OutDir + "/" + Entries[i].Name);
+    OutFile << Input;
+  }
+
+  report("before", Entries, All);
+  report("after", Entries, Kept);
+  if (NumTraced < Entries.size()) {
+    printf("%zu inputs left out, not read or not traced\n", Entries.size() - NumTraced);
+  }
+  if (Passing.size() < NumTraced) {
+    printf("%zu crashing or hanging inputs left out\n", NumTraced - Passing.size());
+  }
+  return 0;
+}
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <unistd.h>
+
+#include "CmpLog.h"
+
+CmpMap *CmpLogMap;
+
+static int ShmId = -1;
+
+static void removeCmpLogMap() { shmctl(ShmId, IPC_RMID, NULL); }
+
+// Handler of the coverage map (see Coverage.cpp), which ends the fuzzer
+static void (*PrevStop)(int);
+
+static void handleStop(int Sig) {
+  removeCmpLogMap();
+  if (PrevStop == SIG_DFL || PrevStop == SIG_IGN || PrevStop == SIG_ERR) {
+    _exit(1);
+  }
+  PrevStop(Sig);
+}
+
+/**
+ * Allocate the comparison table, attached by the target through CMPLOG_ENV_VAR.
+ */
+void initCmpLogMap() {
+  ShmId = shmget(IPC_PRIVATE, sizeof(CmpMap), IPC_CREAT | IPC_EXCL | 0600);
+  if (ShmId < 0) {
+    perror("shmget");
+    exit(1);
+  }
+  atexit(removeCmpLogMap);
+  PrevStop = signal(SIGINT, handleStop);
+  signal(SIGTERM, handleStop);
+  CmpLogMap = (CmpMap *)shmat(ShmId, NULL, 0);
+  if (CmpLogMap == (void *)-1) {
+    perror("shmat");
+    exit(1);
+  }
+  CmpLogMap->Enabled = 0;
+  setenv(CMPLOG_ENV_VAR, std::to_string(ShmId).c_str(), 1);
+}
+
+void startCmpLog() {
+  // Only the headers, entries past the hit count are never read
+  memset(CmpLogMap->Headers, 0, sizeof(CmpLogMap->Headers));
+  CmpLogMap->Enabled = 1;
+}
+
+void stopCmpLog() { CmpLogMap->Enabled = 0; }
+
+/*
+ * Candidates replacing every occurrence of Pattern in Input with Repl.
+ */
+static void addReplacements(const std::string &Input, const uint8_t *Pattern, size_t Len,
+                            const uint8_t *Repl, size_t ReplLen,
+                            std::vector<std::string> &Candidates) {
+  if (Len == 0 || (Len == ReplLen && !memcmp(Pattern, Repl, Len))) {
+    return;
+  }
+  const char *Start = Input.data();
+  const char *End = Start + Input.size();
+  const char *Hit = Start;
+  while (Candidates.size() < I2S_MAX_CANDIDATES &&
+         (Hit = (const char *)memmem(Hit, End - Hit, Pattern, Len))) {
+    std::string Candidate(Input);
+    Candidate.replace(Hit - Start, Len, (const char *)Repl, ReplLen);
+    Candidates.push_back(std::move(Candidate));
+    Hit++;
+  }
+}
+
+/*
+ * Whether Value, an integer of Size bytes, is the zero or sign extension of
+ * its low Width bytes, so that the input may hold it in Width bytes.
+ */
+static bool fitsIn(uint64_t Value, int Size, int Width) {
+  if (Width >= Size) {
+    return true;
+  }
+  int Shift = 64 - Size * 8;
+  int64_t Signed = (int64_t)(Value << Shift) >> Shift;
+  int64_t Low = (int64_t)(Value << (64 - Width * 8)) >> (64 - Width * 8);
+  return (Value >> (Width * 8)) == 0 || Signed == Low;
+}
+
+/*
+ * An integer comparison Pattern == Repl: look for Pattern in the input as a
+ * little or big-endian integer of its width or any narrower width it fits
+ * in, and patch in Repl of the same width.
+ */
+static void addIntReplacements(const std::string &Input, uint64_t Pattern, uint64_t Repl,
+                               int Size, std::vector<std::string> &Candidates) {
+  for (int Width = Size; Width >= 1; Width /= 2) {
+    if (!fitsIn(Pattern, Size, Width) || !fitsIn(Repl, Size, Width)) {
+      continue;
+    }
+    uint8_t P[8], R[8];
+    for (int i = 0; i < Width; i++) {
+      P[i] = Pattern >> (i * 8);
+      R[i] = Repl >> (i * 8);
+    }
+    addReplacements(Input, P, Width, R, Width, Candidates);
+    if (Width > 1) {
+      std::reverse(P, P + Width);
+      std::reverse(R, R + Width);
+      addReplacements(Input, P, Width, R, Width, Candidates);
+    }
+  }
+}
+
+// Length of a logged buffer without its zero padding
+static size_t rtnLength(const uint8_t *V, size_t Size) {
+  while (Size > 1 && V[Size - 1] == 0) {
+    Size--;
+  }
+  return Size;
+}
+
+/**
+ * Input-to-state candidates from the comparisons logged for Input: each
+ * operand found in Input is replaced by the value it was compared against.
+ */
+void collectInputToState(const std::string &Input, std::vector<std::string> &Candidates) {
+  for (int Id = 0; Id < CMP_MAP_W; Id++) {
+    CmpHeader &Header = CmpLogMap->Headers[Id];
+    int Size = Header.Size;
+    int NumLogged = std::min<uint32_t>(Header.Hits, CMP_MAP_H);
+    for (int k = 0; k < NumLogged; k++) {
+      if (Header.Type == CMP_TYPE_INS) {
+        CmpOperands &Ops = CmpLogMap->Log[Id][k].Ins;
+        addIntReplacements(Input, Ops.V0, Ops.V1, Size, Candidates);
+        addIntReplacements(Input, Ops.V1, Ops.V0, Size, Candidates);
+      } else if (Header.Type == CMP_TYPE_RTN) {
+        CmpRtnOperands &Ops = CmpLogMap->Log[Id][k].Rtn;
+        size_t Len0 = rtnLength(Ops.V0, Size), Len1 = rtnLength(Ops.V1, Size);
+        addReplacements(Input, Ops.V0, Len0, Ops.V1, Len1, Candidates);
+        addReplacements(Input, Ops.V1, Len1, Ops.V0, Len0, Candidates);
+        // A shorter string only compares equal with its NUL, not as a prefix
+        // of what follows in the input
+        if (Len1 < Len0) {
+          addReplacements(Input, Ops.V0, Len0, Ops.V1, Len1 + 1, Candidates);
+        } else if (Len0 < Len1) {
+          addReplacements(Input, Ops.V1, Len1, Ops.V0, Len0 + 1, Candidates);
+        }
+      }
+    }
+  }
+}
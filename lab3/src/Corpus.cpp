@@ -0,0 +1,53 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "Corpus.h"
+#include "Coverage.h"
+
+/**
+ * Indices of the kept inputs, in increasing order. Inputs with no tuples are
+ * dropped, the caller decides what to do with inputs of unknown coverage.
+ */
+std::vector<size_t> distillCorpus(const std::vector<const std::vector<uint32_t> *> &Tuples,
+                                  const std::vector<double> &Costs) {
+  std::vector<size_t> Best(NUM_TUPLES, SIZE_MAX);
+  std::vector<uint32_t> NumCovering(NUM_TUPLES, 0);
+  for (size_t i = 0; i < Tuples.size(); i++) {
+    for (uint32_t Tuple : *Tuples[i]) {
+      NumCovering[Tuple]++;
+      if (Best[Tuple] == SIZE_MAX || Costs[i] < Costs[Best[Tuple]]) {
+        Best[Tuple] = i;
+      }
+    }
+  }
+
+  std::vector<uint32_t> Order;
+  for (uint32_t Tuple = 0; Tuple < NUM_TUPLES; Tuple++) {
+    if (NumCovering[Tuple]) {
+      Order.push_back(Tuple);
+    }
+  }
+  std::stable_sort(Order.begin(), Order.end(), [&](uint32_t A, uint32_t B) {
+    return NumCovering[A] < NumCovering[B];
+  });
+
+  std::vector<bool> Covered(NUM_TUPLES, false);
+  std::vector<bool> Kept(Tuples.size(), false);
+  for (uint32_t Tuple : Order) {
+    if (Covered[Tuple]) {
+      continue;
+    }
+    Kept[Best[Tuple]] = true;
+    for (uint32_t Other : *Tuples[Best[Tuple]]) {
+      Covered[Other] = true;
+    }
+  }
+
+  std::vector<size_t> Result;
+  for (size_t i = 0; i < Tuples.size(); i++) {
+    if (Kept[i]) {
+      Result.push_back(i);
+    }
+  }
+  return Result;
+}
@@ -0,0 +1,122 @@
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CorpusStore.h"
+
+PackWriter::PackWriter() : DataFd(-1), IndexFd(-1), DataBytes(0), HasLast(false), LastId(0) {}
+
+PackWriter::~PackWriter() {
+  if (DataFd >= 0) {
+    close(DataFd);
+    close(IndexFd);
+  }
+}
+
+bool PackWriter::open(const std::string &Base, bool Append) {
+  int Flags = O_CREAT | O_APPEND | (Append ? 0 : O_TRUNC);
+  std::string DataPath = Base + ".pack", IndexPath = Base + ".idx";
+  DataFd = ::open(DataPath.c_str(), O_WRONLY | Flags, 0644);
+  // Read as well, for the Id of its last record
+  IndexFd = ::open(IndexPath.c_str(), O_RDWR | Flags, 0644);
+  struct stat Data, Index;
+  bool Opened = DataFd >= 0 && IndexFd >= 0 && !fstat(DataFd, &Data) && !fstat(IndexFd, &Index);
+  // A torn record at the end is cut off, the last whole one has the last Id
+  off_t IndexBytes = Opened ? Index.st_size - Index.st_size % sizeof(PackEntry) : 0;
+  PackEntry Last;
+  if (!Opened || ftruncate(IndexFd, IndexBytes) ||
+      (IndexBytes &&
+       pread(IndexFd, &Last, sizeof(Last), IndexBytes - sizeof(Last)) != sizeof(Last))) {
+    perror(Base.c_str());
+    if (DataFd >= 0) {
+      close(DataFd);
+    }
+    if (IndexFd >= 0) {
+      close(IndexFd);
+    }
+    DataFd = IndexFd = -1;
+    return false;
+  }
+  // Data past the last record, if any, is skipped over rather than reused
+  DataBytes = Data.st_size;
+  HasLast = IndexBytes > 0;
+  LastId = HasLast ? Last.Id : 0;
+  return true;
+}
+
+/**
+ * A short write (disk full, file size limit) is cut off again, so that the
+ * next input starts where its index record says. Should the cut fail, the
+ * bytes that were written are skipped over like the tail of a torn pack.
+ */
+bool PackWriter::append(const std::string &Input, uint32_t Id) {
+  PackEntry Entry = {DataBytes, (uint32_t)Input.size(), Id};
+  ssize_t Written = write(DataFd, Input.data(), Input.size());
+  if (Written != (ssize_t)Input.size()) {
+    if (Written > 0 && ftruncate(DataFd, DataBytes)) {
+      DataBytes += Written;
+    }
+    return false;
+  }
+  DataBytes += Input.size();
+  Written = write(IndexFd, &Entry, sizeof(Entry));
+  if (Written != sizeof(Entry)) {
+    // A partial record would shift every record after it
+    if (Written > 0) {
+      off_t IndexBytes = lseek(IndexFd, 0, SEEK_END);
+      ftruncate(IndexFd, IndexBytes - IndexBytes % sizeof(PackEntry));
+    }
+    return false;
+  }
+  HasLast = true;
+  LastId = Id;
+  return true;
+}
+
+bool PackWriter::lastId(uint32_t &Id) const {
+  Id = LastId;
+  return HasLast;
+}
+
+PackReader::PackReader()
+    : Data(NULL), DataBytes(0), Index(NULL), IndexBytes(0), NumEntries(0) {}
+
+PackReader::~PackReader() {
+  if (Data) {
+    munmap((void *)Data, DataBytes);
+  }
+  if (Index) {
+    munmap((void *)Index, IndexBytes);
+  }
+}
+
+static const void *mapFile(const std::string &Path, size_t &Size) {
+  int Fd = ::open(Path.c_str(), O_RDONLY);
+  if (Fd < 0) {
+    return NULL;
+  }
+  struct stat Buffer;
+  Size = fstat(Fd, &Buffer) ? 0 : Buffer.st_size;
+  void *Map = Size ? mmap(NULL, Size, PROT_READ, MAP_SHARED, Fd, 0) : MAP_FAILED;
+  close(Fd);
+  return Map == MAP_FAILED ? NULL : Map;
+}
+
+bool PackReader::open(const std::string &Base) {
+  Data = (const char *)mapFile(Base + ".pack", DataBytes);
+  Index = (const PackEntry *)mapFile(Base + ".idx", IndexBytes);
+  if (!Index) {
+    return false;
+  }
+  // Every record of the index refers to data written before it
+  NumEntries = IndexBytes / sizeof(PackEntry);
+  for (size_t i = 0; i < NumEntries; i++) {
+    if (Index[i].Offset + Index[i].Size > DataBytes) {
+      NumEntries = i;
+      break;
+    }
+  }
+  return true;
+}
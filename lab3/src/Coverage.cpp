@@ -0,0 +1,296 @@
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Checkpoint.h"
+#include "Coverage.h"
+
+uint8_t *TraceBits;
+CrashReport *LastCrash;
+uint8_t *VirginBits;
+uint8_t *VirginHangs;
+
+static int ShmId = -1;
+
+// Classified value of two adjacent map bytes at once, filled by initCoverageMap
+static uint16_t Count16Lookup[1 << 16];
+
+static void removeCoverageMap() { shmctl(ShmId, IPC_RMID, NULL); }
+
+/*
+ * SIGINT/SIGTERM: exit() is not safe in a signal handler, the interrupted
+ * code may hold the locks of stdio or malloc. Only the system call to remove
+ * the segment, and _exit.
+ */
+static void handleStop(int) {
+  removeCoverageMap();
+  _exit(1);
+}
+
+/**
+ * Allocate the shared coverage map and crash report once, before the first
+ * execution. The target attaches to them through SHM_ENV_VAR.
+ */
+void initCoverageMap() {
+  uint8_t Count8Lookup[256];
+  Count8Lookup[0] = 0;
+  Count8Lookup[1] = 1;
+  Count8Lookup[2] = 2;
+  Count8Lookup[3] = 4;
+  for (int i = 4; i < 256; i++) {
+    Count8Lookup[i] = i < 8 ? 8 : i < 16 ? 16 : i < 32 ? 32 : i < 128 ? 64 : 128;
+  }
+  for (int i = 0; i < (1 << 16); i++) {
+    Count16Lookup[i] = Count8Lookup[i >> 8] << 8 | Count8Lookup[i & 0xff];
+  }
+
+  ShmId = shmget(IPC_PRIVATE, MAP_SIZE + sizeof(CrashReport), IPC_CREAT | IPC_EXCL | 0600);
+  if (ShmId < 0) {
+    perror("shmget");
+    exit(1);
+  }
+  // Make sure the segment does not outlive the fuzzer
+  atexit(removeCoverageMap);
+  signal(SIGINT, handleStop);
+  signal(SIGTERM, handleStop);
+
+  TraceBits = (uint8_t *)shmat(ShmId, NULL, 0);
+  if (TraceBits == (void *)-1) {
+    perror("shmat");
+    exit(1);
+  }
+  LastCrash = (CrashReport *)(TraceBits + MAP_SIZE);
+  setenv(SHM_ENV_VAR, std::to_string(ShmId).c_str(), 1);
+}
+
+/**
+ * Allocate the virgin map, in memory inherited by forked workers if Shared.
+ */
+static uint8_t *allocVirginMap(bool Shared) {
+  uint8_t *Virgin;
+  if (Shared) {
+    Virgin = (uint8_t *)mmap(NULL, MAP_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (Virgin == MAP_FAILED) {
+      perror("mmap");
+      exit(1);
+    }
+  } else {
+    Virgin = new uint8_t[MAP_SIZE];
+  }
+  memset(Virgin, 0xff, MAP_SIZE);
+  return Virgin;
+}
+
+void initVirginMap(bool Shared) {
+  VirginBits = allocVirginMap(Shared);
+  VirginHangs = allocVirginMap(Shared);
+}
+
+void resetCoverageMap() {
+  memset(TraceBits, 0, MAP_SIZE);
+  LastCrash->Kind = CRASH_NONE;
+}
+
+/**
+ * In place, skipping untouched 16-byte blocks, two bytes per table lookup.
+ */
+void classifyCounts(uint8_t *Trace) {
+  uint64_t *Words = (uint64_t *)Trace;
+  for (int i = 0; i < MAP_SIZE / 8; i += 2) {
+#ifdef __SSE2__
+    __m128i Block = _mm_loadu_si128((__m128i *)&Words[i]);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(Block, _mm_setzero_si128())) == 0xffff) {
+      continue;
+    }
+#else
+    if (!(Words[i] | Words[i + 1])) {
+      continue;
+    }
+#endif
+    for (int j = i; j < i + 2; j++) {
+      if (!Words[j]) {
+        continue;
+      }
+      uint16_t *Pairs = (uint16_t *)&Words[j];
+      Pairs[0] = Count16Lookup[Pairs[0]];
+      Pairs[1] = Count16Lookup[Pairs[1]];
+      Pairs[2] = Count16Lookup[Pairs[2]];
+      Pairs[3] = Count16Lookup[Pairs[3]];
+    }
+  }
+}
+
+void traceTuples(const uint8_t *Trace, std::vector<uint32_t> &Tuples) {
+  const uint64_t *Words = (const uint64_t *)Trace;
+  for (uint32_t i = 0; i < MAP_SIZE / 8; i++) {
+    if (!Words[i]) {
+      continue;
+    }
+    for (uint32_t Entry = i * 8; Entry < i * 8 + 8; Entry++) {
+      if (Trace[Entry]) {
+        Tuples.push_back(Entry << TUPLE_BITS | __builtin_ctz(Trace[Entry]));
+      }
+    }
+  }
+}
+
+/**
+ * Check the last, classified, execution against the virgin map and clear
+ * the newly hit bucket bits in it. Word by word, skipping untouched 32-byte
+ * blocks. The clear is atomic so that only one worker claims a new bucket.
+ */
+bool hasNewCoverage(uint8_t *Virgin) {
+  uint64_t *Current = (uint64_t *)TraceBits;
+  bool NewCoverage = false;
+  for (int i = 0; i < MAP_SIZE / 8; i += 4) {
+#ifdef __SSE2__
+    __m128i Lo = _mm_loadu_si128((__m128i *)&Current[i]);
+    __m128i Hi = _mm_loadu_si128((__m128i *)&Current[i + 2]);
+    __m128i Zero = _mm_cmpeq_epi8(_mm_or_si128(Lo, Hi), _mm_setzero_si128());
+    if (_mm_movemask_epi8(Zero) == 0xffff) {
+      continue;
+    }
+#else
+    if (!(Current[i] | Current[i + 1] | Current[i + 2] | Current[i + 3])) {
+      continue;
+    }
+#endif
+    for (int j = i; j < i + 4; j++) {
+      uint64_t *Vir = (uint64_t *)&Virgin[j * 8];
+      if ((Current[j] & *Vir) &&
+          (__atomic_fetch_and(Vir, ~Current[j], __ATOMIC_RELAXED) & Current[j])) {
+        NewCoverage = true;
+      }
+    }
+  }
+  return NewCoverage;
+}
+
+/**
+ * Number of map entries ever covered.
+ */
+int countCoverage(uint8_t *Virgin) {
+  int Count = 0;
+  for (int i = 0; i < MAP_SIZE; i++) {
+    Count += Virgin[i] != 0xff;
+  }
+  return Count;
+}
+
+/**
+ * Merges the two sorted tuple lists, an entry whose bucket changed shows up
+ * on both sides.
+ */
+int markVariable(const std::vector<uint32_t> &Tuples, const uint8_t *Trace, uint8_t *Variable) {
+  static std::vector<uint32_t> Current;
+  Current.clear();
+  traceTuples(Trace, Current);
+  int NumMarked = 0;
+  size_t i = 0, j = 0;
+  while (i < Tuples.size() || j < Current.size()) {
+    uint32_t Tuple;
+    if (j == Current.size() || (i < Tuples.size() && Tuples[i] < Current[j])) {
+      Tuple = Tuples[i++];
+    } else if (i == Tuples.size() || Current[j] < Tuples[i]) {
+      Tuple = Current[j++];
+    } else {
+      i++;
+      j++;
+      continue;
+    }
+    uint8_t &Mark = Variable[Tuple >> TUPLE_BITS];
+    NumMarked += !Mark;
+    Mark = 1;
+  }
+  return NumMarked;
+}
+
+uint64_t hashCoverageMap() {
+  const uint64_t *Words = (const uint64_t *)TraceBits;
+  uint64_t Hash = 0;
+  for (uint64_t i = 0; i < MAP_SIZE / 8; i++) {
+    if (Words[i]) {
+      Hash = (Hash ^ (Words[i] * 0xff51afd7ed558ccdULL + i)) * 0x9e3779b97f4a7c15ULL;
+      Hash ^= Hash >> 29;
+    }
+  }
+  return Hash;
+}
+
+// Never a valid (line << 32) | col key
+static const uint64_t EmptySlot = ~0ULL;
+
+static inline size_t slotOf(uint64_t Key, size_t Mask) {
+  return (Key * 0x9e3779b97f4a7c15ULL) >> 32 & Mask;
+}
+
+CoverageSet::CoverageSet() : Slots(1024, EmptySlot), Count(0) {}
+
+bool CoverageSet::insert(uint64_t Key) {
+  size_t Mask = Slots.size() - 1;
+  for (size_t i = slotOf(Key, Mask);; i = (i + 1) & Mask) {
+    if (Slots[i] == Key) {
+      return false;
+    }
+    if (Slots[i] == EmptySlot) {
+      Slots[i] = Key;
+      // Keep the load under 1/2 so that probes stay short
+      if (++Count * 2 > Slots.size()) {
+        grow();
+      }
+      return true;
+    }
+  }
+}
+
+void CoverageSet::save(FILE *F) const {
+  writeVector(F, Slots);
+  uint64_t Size = Count;
+  writeRaw(F, &Size, 1);
+}
+
+bool CoverageSet::load(FILE *F) {
+  uint64_t Size;
+  if (!readVector(F, Slots) || !readRaw(F, &Size, 1) || Slots.empty() ||
+      (Slots.size() & (Slots.size() - 1))) {
+    return false;
+  }
+  Count = Size;
+  return true;
+}
+
+void CoverageSet::grow() {
+  std::vector<uint64_t> Old(Slots.size() * 2, EmptySlot);
+  Old.swap(Slots);
+  size_t Mask = Slots.size() - 1;
+  for (uint64_t Key : Old) {
+    if (Key == EmptySlot) {
+      continue;
+    }
+    size_t i = slotOf(Key, Mask);
+    while (Slots[i] != EmptySlot) {
+      i = (i + 1) & Mask;
+    }
+    Slots[i] = Key;
+  }
+}
+
+/**
+ * Key of a "line,col" line of the .cov file.
+ */
+uint64_t coverageKey(const std::string &Line) {
+  char *Comma;
+  uint64_t LineNo = strtoul(Line.c_str(), &Comma, 10);
+  uint64_t Col = *Comma == ',' ? strtoul(Comma + 1, NULL, 10) : 0;
+  return LineNo << 32 | Col;
+}
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+
+#include "Deterministic.h"
+
+// AFL's interesting values: the 8-bit ones, then those added at 16 and 32 bits
+static const int32_t InterestingValues[] = {
+    -128,      -1,         0,      1,     16,    32,        64,       100,   127,
+    -32768,    -129,       128,    255,   256,   512,       1000,     1024,  4096, 32767,
+    INT32_MIN, -100663046, -32769, 32768, 65535, 65536,     100663045, INT32_MAX};
+// Number of the values above tried at a width of 1, 2 and 4 bytes
+static const uint32_t NumInteresting[] = {9, 19, 27};
+
+static uint32_t widthMask(int Width) { return Width == 4 ? UINT32_MAX : (1u << (Width * 8)) - 1; }
+
+static uint32_t byteSwap(uint32_t Value, int Width) {
+  uint32_t Swapped = 0;
+  for (int i = 0; i < Width; i++) {
+    Swapped |= (Value >> (i * 8) & 0xff) << ((Width - 1 - i) * 8);
+  }
+  return Swapped;
+}
+
+static uint32_t load(const std::string &Data, size_t Pos, int Width, bool Big) {
+  uint32_t Value = 0;
+  for (int i = 0; i < Width; i++) {
+    Value |= (uint32_t)(uint8_t)Data[Pos + (Big ? Width - 1 - i : i)] << (i * 8);
+  }
+  return Value;
+}
+
+static void store(std::string &Data, size_t Pos, int Width, bool Big, uint32_t Value) {
+  for (int i = 0; i < Width; i++) {
+    Data[Pos + (Big ? Width - 1 - i : i)] = (char)(Value >> (i * 8));
+  }
+}
+
+/*
+ * Whether any byte of [Pos, Pos + Width) is worth mutating, all of them are
+ * until DET_FLIP8 has built the effector map.
+ */
+static bool effective(const DetProgress &Progress, size_t Pos, int Width) {
+  if (Progress.Effector.empty()) {
+    return true;
+  }
+  for (int i = 0; i < Width; i++) {
+    if (Progress.Effector[Pos + i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Once DET_FLIP8 is over: a map that marks nearly everything is not worth
+ * the holes it leaves, mark everything.
+ */
+static void finishEffector(DetProgress &Progress) {
+  size_t Size = Progress.Effector.size();
+  size_t Marked = std::count(Progress.Effector.begin(), Progress.Effector.end(), 1);
+  if (Marked * 100 > Size * EFF_MAX_PERC) {
+    std::fill(Progress.Effector.begin(), Progress.Effector.end(), 1);
+  }
+}
+
+/**
+ * Walking bit flips (1, 2, 4 bits), byte flips (1, 2, 4 bytes), +/- 1 to
+ * ARITH_MAX on 1, 2 and 4-byte integers and AFL's interesting values, the
+ * wider ones in both byte orders. Past DET_FLIP8, bytes whose flip did not
+ * change the coverage are skipped, as are arithmetic results a narrower
+ * stage already made.
+ */
+int nextDeterministic(const std::string &Seed, DetProgress &Progress, std::string &Mutant) {
+  size_t Size = Seed.size();
+  while (Progress.Stage != DET_DONE) {
+    int Stage = Progress.Stage;
+    switch (Stage) {
+    case DET_FLIP1:
+    case DET_FLIP2:
+    case DET_FLIP4: {
+      size_t Bits = 1 << (Stage - DET_FLIP1);
+      if (Progress.Pos + Bits > Size * 8) {
+        break;
+      }
+      Mutant.assign(Seed);
+      for (size_t Bit = Progress.Pos; Bit < Progress.Pos + Bits; Bit++) {
+        Mutant[Bit >> 3] ^= 128 >> (Bit & 7);
+      }
+      Progress.Pos++;
+      return Stage;
+    }
+    case DET_FLIP8:
+    case DET_FLIP16:
+    case DET_FLIP32: {
+      int Width = 1 << (Stage - DET_FLIP8);
+      if (Stage == DET_FLIP8 && Progress.Pos == 0 && Size) {
+        // Like AFL, the first and last bytes are always worth it
+        Progress.Effector.assign(Size, Size < EFF_MIN_LEN);
+        Progress.Effector[0] = Progress.Effector[Size - 1] = 1;
+      }
+      while (Stage != DET_FLIP8 && Progress.Pos + Width <= Size &&
+             !effective(Progress, Progress.Pos, Width)) {
+        Progress.Pos++;
+      }
+      if (Progress.Pos + Width > Size) {
+        break;
+      }
+      Mutant.assign(Seed);
+      for (int i = 0; i < Width; i++) {
+        Mutant[Progress.Pos + i] ^= 0xff;
+      }
+      Progress.Pos++;
+      return Stage;
+    }
+    case DET_ARITH8:
+    case DET_ARITH16:
+    case DET_ARITH32:
+    case DET_INTEREST8:
+    case DET_INTEREST16:
+    case DET_INTEREST32: {
+      bool Arith = Stage <= DET_ARITH32;
+      int Log2 = Stage - (Arith ? DET_ARITH8 : DET_INTEREST8);
+      int Width = 1 << Log2;
+      uint32_t PerOrder = Arith ? 2 * ARITH_MAX : NumInteresting[Log2];
+      uint32_t NumSteps = Width > 1 ? 2 * PerOrder : PerOrder;
+      while (Progress.Pos + Width <= Size) {
+        if (Progress.Step >= NumSteps || !effective(Progress, Progress.Pos, Width)) {
+          Progress.Pos++;
+          Progress.Step = 0;
+          continue;
+        }
+        uint32_t Step = Progress.Step++;
+        bool Big = Step >= PerOrder;
+        Step %= PerOrder;
+        uint32_t Orig = load(Seed, Progress.Pos, Width, Big);
+        uint32_t Value;
+        if (Arith) {
+          uint32_t Delta = Step % ARITH_MAX + 1;
+          Value = (Step < ARITH_MAX ? Orig + Delta : Orig - Delta) & widthMask(Width);
+          // Only the low byte changed: DET_ARITH8 made it
+          if (Width > 1 && !((Orig ^ Value) & ~0xffu)) {
+            continue;
+          }
+        } else {
+          Value = (uint32_t)InterestingValues[Step] & widthMask(Width);
+          // Identical to the seed, or to the little-endian store
+          if (Value == Orig || (Big && byteSwap(Value, Width) == Value)) {
+            continue;
+          }
+        }
+        Mutant.assign(Seed);
+        store(Mutant, Progress.Pos, Width, Big, Value);
+        return Stage;
+      }
+      break;
+    }
+    }
+    // The stage is exhausted
+    if (Stage == DET_FLIP8) {
+      finishEffector(Progress);
+    }
+    Progress.Stage++;
+    Progress.Pos = 0;
+    Progress.Step = 0;
+  }
+  return DET_DONE;
+}
+
+void markEffector(DetProgress &Progress, bool Changed) {
+  if (Changed) {
+    Progress.Effector[Progress.Pos - 1] = 1;
+  }
+}
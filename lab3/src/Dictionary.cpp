@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+
+#include "Dictionary.h"
+
+std::vector<std::string> Dictionary;
+
+/*
+ * Value of the "..." part of a dictionary line, with \xNN, \\ and \" escapes.
+ */
+static bool parseToken(const std::string &Line, std::string &Keyword, std::string &Token) {
+  size_t Eq = Line.find('=');
+  size_t Open = Line.find('"');
+  size_t Close = Line.rfind('"');
+  if (Open == std::string::npos || Close <= Open) {
+    return false;
+  }
+  Keyword = Eq < Open ? Line.substr(0, Eq) : "";
+  Token.clear();
+  for (size_t i = Open + 1; i < Close; i++) {
+    if (Line[i] != '\\' || i + 1 >= Close) {
+      Token += Line[i];
+    } else if (Line[i + 1] == 'x' && i + 3 < Close) {
+      Token += (char)strtol(Line.substr(i + 2, 2).c_str(), NULL, 16);
+      i += 3;
+    } else {
+      Token += Line[++i];
+    }
+  }
+  return !Token.empty() && Token.size() <= MAX_TOKEN_LEN;
+}
+
+/*
+ * Little and big-endian forms of a little-endian integer token, at its
+ * width and at every narrower width it zero- or sign-extends from.
+ */
+static void addIntegerVariants(const std::string &Token, std::set<std::string> &Tokens) {
+  int Size = Token.size();
+  uint64_t Value = 0;
+  for (int i = 0; i < Size; i++) {
+    Value |= (uint64_t)(uint8_t)Token[i] << (i * 8);
+  }
+  int64_t Signed = (int64_t)(Value << (64 - Size * 8)) >> (64 - Size * 8);
+  for (int Width = Size; Width >= 1; Width /= 2) {
+    int64_t Low = (int64_t)(Value << (64 - Width * 8)) >> (64 - Width * 8);
+    if (Width < Size && (Value >> (Width * 8)) != 0 && Low != Signed) {
+      continue;
+    }
+    std::string Variant = Token.substr(0, Width);
+    Tokens.insert(Variant);
+    std::reverse(Variant.begin(), Variant.end());
+    Tokens.insert(Variant);
+  }
+}
+
+/**
+ * Load the dictionary written by the Dictionary pass, or any AFL-style
+ * dictionary. Returns the number of tokens, -1 if Path cannot be read.
+ */
+int loadDictionary(const std::string &Path) {
+  std::ifstream File(Path);
+  if (!File.is_open()) {
+    return -1;
+  }
+  std::set<std::string> Tokens;
+  std::string Line, Keyword, Token;
+  while (std::getline(File, Line)) {
+    if (Line.empty() || Line[0] == '#' || !parseToken(Line, Keyword, Token)) {
+      continue;
+    }
+    bool Integer = Keyword == "int16" || Keyword == "int32" || Keyword == "int64";
+    if (Integer && Token.size() * 8 == (size_t)atoi(Keyword.c_str() + 3)) {
+      addIntegerVariants(Token, Tokens);
+    } else {
+      Tokens.insert(Token);
+    }
+  }
+  Dictionary.assign(Tokens.begin(), Tokens.end());
+  return Dictionary.size();
+}
@@ -0,0 +1,109 @@
+#include "Instrument.h"
+
+using namespace llvm;
+
+namespace instrument {
+
+/* Must match MAX_TOKEN_LEN in Dictionary.h */
+static const unsigned int MaxTokenLen = 64;
+
+static cl::opt<std::string> DictionaryFile("dictionary",
+    cl::desc("Token dictionary written for the fuzzer (default: <source>.dict)"),
+    cl::init(""));
+
+/*
+ * One dictionary line, AFL syntax: the keyword tells the fuzzer whether the
+ * token is an integer of that width (little-endian) or raw bytes.
+ */
+static std::string formatToken(StringRef Keyword, StringRef Bytes) {
+  std::string Line = Keyword.str() + "=\"";
+  char Hex[8];
+  for (unsigned char C : Bytes) {
+    if(C >= 0x20 && C < 0x7f && C != '"' && C != '\\') {
+      Line += C;
+    } else {
+      snprintf(Hex, sizeof(Hex), "\\x%02x", C);
+      Line += Hex;
+    }
+  }
+  return Line + "\"";
+}
+
+void DictionaryPass::addInteger(Value *V) {
+  ConstantInt *C = dyn_cast<ConstantInt>(V);
+  if(!C) {
+    return;
+  }
+  unsigned int Width = C->getBitWidth();
+  if(Width != 8 && Width != 16 && Width != 32 && Width != 64) {
+    return;
+  }
+  /* 0, 1 and -1 are everywhere and the mutators produce them anyway */
+  if(C->isZero() || C->isOne() || C->isMinusOne()) {
+    return;
+  }
+  uint64_t Value = C->getZExtValue();
+  std::string Bytes;
+  for (unsigned int i = 0; i < Width / 8; i++) {
+    Bytes += (char)(Value >> (i * 8));
+  }
+  Tokens.insert(formatToken("int" + std::to_string(Width), Bytes));
+}
+
+void DictionaryPass::addString(Value *V) {
+  GlobalVariable *G = dyn_cast<GlobalVariable>(V->stripPointerCasts());
+  if(!G || !G->isConstant() || !G->hasInitializer()) {
+    return;
+  }
+  ConstantDataSequential *Data = dyn_cast<ConstantDataSequential>(G->getInitializer());
+  if(!Data || !Data->isString()) {
+    return;
+  }
+  StringRef Bytes = Data->isCString() ? Data->getAsCString() : Data->getAsString();
+  if(Bytes.empty() || Bytes.size() > MaxTokenLen) {
+    return;
+  }
+  Tokens.insert(formatToken("str", Bytes));
+}
+
+/*
+ * Collect comparison operands, switch cases and constant strings.
+ */
+bool DictionaryPass::runOnModule(Module &M) {
+  for (GlobalVariable &G : M.globals()) {
+    addString(&G);
+  }
+  for (Function &F : M) {
+    for (inst_iterator It = inst_begin(F), E = inst_end(F); It != E; ++It) {
+      if(ICmpInst *Cmp = dyn_cast<ICmpInst>(&*It)) {
+        addInteger(Cmp->getOperand(0));
+        addInteger(Cmp->getOperand(1));
+      } else if(SwitchInst *Switch = dyn_cast<SwitchInst>(&*It)) {
+        for (auto Case : Switch->cases()) {
+          addInteger(Case.getCaseValue());
+        }
+      } else if(CallInst *Call = dyn_cast<CallInst>(&*It)) {
+        for (Value *Arg : Call->args()) {
+          addString(Arg);
+        }
+      }
+    }
+  }
+
+  std::string Path = DictionaryFile;
+  if(Path.empty()) {
+    Path = M.getSourceFileName();
+    Path = Path.substr(0, Path.rfind('.')) + ".dict";
+  }
+  std::ofstream DictFile(Path);
+  for (auto &Token : Tokens) {
+    DictFile << Token << "\n";
+  }
+  return false;
+}
+
+char DictionaryPass::ID = 2;
+static RegisterPass<DictionaryPass>
+    Y("Dictionary", "Token dictionary extraction for the fuzzer", false, true);
+
+} // namespace instrument
@@ -0,0 +1,59 @@
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+#include <string>
+
+#include "CorpusStore.h"
+
+/*
+ * Writes the packed inputs of a fuzzer output directory (see CorpusStore.h)
+ * out as the files the fuzzer used to store: success/inputN, failure/inputN
+ * and hangs/inputN, for the tools and scripts that read those.
+ * usage: export [output dir]
+ */
+
+static size_t exportPack(const std::string &Base, const std::string &Dir) {
+  PackReader Pack;
+  if (!Pack.open(Base)) {
+    return 0;
+  }
+  mkdir(Dir.c_str(), 0755);
+  for (size_t i = 0; i < Pack.size(); i++) {
+    std::string Path = Dir + "/input" + std::to_string(Pack.entry(i).Id);
+    FILE *F = fopen(Path.c_str(), "wb");
+    if (!F) {
+      perror(Path.c_str());
+      continue;
+    }
+    fwrite(Pack.data(i), 1, Pack.entry(i).Size, F);
+    fclose(F);
+  }
+  return Pack.size();
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("usage %s [output dir]\n", argv[0]);
+    return 1;
+  }
+  std::string OutDir(argv[1]);
+  const char *Kinds[] = {"success", "failure", "hangs"};
+  for (const char *Kind : Kinds) {
+    size_t Count = 0;
+    // One pack per worker, as fuzzer_stats
+    for (int Worker = 0;; Worker++) {
+      std::string Base = OutDir + "/" + Kind;
+      if (Worker > 0) {
+        Base += "." + std::to_string(Worker);
+      }
+      struct stat Buffer;
+      if (stat((Base + ".idx").c_str(), &Buffer)) {
+        break;
+      }
+      Count += exportPack(Base, OutDir + "/" + Kind);
+    }
+    printf("%-8s %8zu inputs\n", Kind, Count);
+  }
+  return 0;
+}
@@ -0,0 +1,467 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Grammar.h"
+#include "Mutator.h"
+
+// RFC 8259, strings and numbers as tokens, whitespace as no node
+static const char *const JsonGrammar =
+    "json = _ value _\n"
+    "value = object | array | STRING | NUMBER | 'true' | 'false' | 'null'\n"
+    "object = '{' _ '}' | '{' _ member next_member* '}'\n"
+    "member = STRING _ ':' _ value _\n"
+    "next_member = ',' _ member\n"
+    "array = '[' _ ']' | '[' _ element next_element* ']'\n"
+    "element = value _\n"
+    "next_element = ',' _ element\n"
+    "STRING = '\"' char* '\"'\n"
+    "char = [ !#-[\\]-~] | [\\x7f-\\xff] | '\\\\' escape\n"
+    "escape = [\"\\\\/bfnrt] | 'u' hex hex hex hex\n"
+    "hex = [0-9a-fA-F]\n"
+    "NUMBER = '-'? int fraction? exponent?\n"
+    "int = '0' | [1-9] [0-9]*\n"
+    "fraction = '.' [0-9] [0-9]*\n"
+    "exponent = [eE] [+\\-]? [0-9] [0-9]*\n"
+    "_ = [ \\t\\n\\r]*\n";
+
+const char *const TreeMutationNames[NUM_TREE_MUTATIONS] = {
+    "tree-replace", "tree-splice", "tree-expand", "tree-repeat", "tree-delete"};
+
+const std::string *(*TreeSplicePartner)(Random &Rng, const DerivationTree **Tree) = NULL;
+
+static bool isNameChar(char C) { return isalnum((unsigned char)C) || C == '_'; }
+
+/**
+ * The character escaped by the backslash before Pos: \n, \t, \r, \xHH, or
+ * the character itself.
+ */
+static char unescape(const std::string &Text, size_t &Pos) {
+  char C = Text[Pos++];
+  switch (C) {
+  case 'n':
+    return '\n';
+  case 't':
+    return '\t';
+  case 'r':
+    return '\r';
+  case 'x':
+    if (Pos + 2 <= Text.size()) {
+      std::string Hex = Text.substr(Pos, 2);
+      Pos += 2;
+      return (char)strtol(Hex.c_str(), NULL, 16);
+    }
+    return C;
+  default:
+    return C;
+  }
+}
+
+static char nextChar(const std::string &Text, size_t &Pos) {
+  char C = Text[Pos++];
+  return C == '\\' && Pos < Text.size() ? unescape(Text, Pos) : C;
+}
+
+bool Grammar::parseSymbol(const std::string &Text, size_t &Pos, GrammarSymbol &Symbol,
+                          int Line) {
+  char C = Text[Pos];
+  if (C == '\'') {
+    std::string Literal;
+    for (Pos++; Pos < Text.size() && Text[Pos] != '\'';) {
+      Literal += nextChar(Text, Pos);
+    }
+    if (Pos++ >= Text.size() || Literal.empty()) {
+      fprintf(stderr, "grammar line %d: unterminated or empty literal\n", Line);
+      return false;
+    }
+    Symbol = {SYMBOL_LITERAL, 0, (uint32_t)Literals.size()};
+    Literals.push_back(Literal);
+  } else if (C == '[') {
+    CharClass Class = {};
+    for (Pos++; Pos < Text.size() && Text[Pos] != ']';) {
+      uint8_t First = nextChar(Text, Pos), Last = First;
+      if (Pos + 1 < Text.size() && Text[Pos] == '-' && Text[Pos + 1] != ']') {
+        Pos++;
+        Last = nextChar(Text, Pos);
+      }
+      for (int Char = First; Char <= Last; Char++) {
+        if (!Class.has(Char)) {
+          Class.Bits[Char >> 6] |= 1ULL << (Char & 63);
+          Class.Chars += (char)Char;
+        }
+      }
+    }
+    if (Pos++ >= Text.size() || Class.Chars.empty()) {
+      fprintf(stderr, "grammar line %d: unterminated or empty class\n", Line);
+      return false;
+    }
+    Symbol = {SYMBOL_CLASS, 0, (uint32_t)Classes.size()};
+    Classes.push_back(Class);
+  } else if (isNameChar(C)) {
+    size_t Start = Pos;
+    while (Pos < Text.size() && isNameChar(Text[Pos])) {
+      Pos++;
+    }
+    std::string Name = Text.substr(Start, Pos - Start);
+    auto It = std::find_if(Rules.begin(), Rules.end(),
+                           [&](const GrammarRule &Rule) { return Rule.Name == Name; });
+    if (It == Rules.end()) {
+      fprintf(stderr, "grammar line %d: no rule %s\n", Line, Name.c_str());
+      return false;
+    }
+    Symbol = {SYMBOL_RULE, 0, (uint32_t)(It - Rules.begin())};
+  } else {
+    fprintf(stderr, "grammar line %d: unexpected %c\n", Line, C);
+    return false;
+  }
+  if (Pos < Text.size() && (Text[Pos] == '?' || Text[Pos] == '*')) {
+    Symbol.Repeat = Text[Pos++];
+  }
+  return true;
+}
+
+/**
+ * Fewest rule levels each rule takes down to text only, by fixed point.
+ * The generator takes that way out once it is deep enough.
+ */
+bool Grammar::computeHeights() {
+  for (auto &Rule : Rules) {
+    Rule.MinHeight = UINT32_MAX;
+  }
+  for (bool Changed = true; Changed;) {
+    Changed = false;
+    for (auto &Rule : Rules) {
+      for (size_t i = 0; i < Rule.Alternatives.size(); i++) {
+        uint32_t Height = 1;
+        for (const GrammarSymbol &Symbol : Rule.Alternatives[i]) {
+          // Optional symbols can be left out
+          if (Symbol.Kind == SYMBOL_RULE && !Symbol.Repeat) {
+            uint32_t Below = Rules[Symbol.Index].MinHeight;
+            Height = Below == UINT32_MAX ? UINT32_MAX : std::max(Height, Below + 1);
+          }
+        }
+        if (Height < Rule.MinHeight) {
+          Rule.MinHeight = Height;
+          Rule.MinAlternative = i;
+          Changed = true;
+        }
+      }
+    }
+  }
+  for (auto &Rule : Rules) {
+    if (Rule.MinHeight == UINT32_MAX) {
+      fprintf(stderr, "grammar: rule %s never derives text only\n", Rule.Name.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Grammar::load(const std::string &Description) {
+  std::string Text = Description == "json" ? JsonGrammar : Description;
+  Rules.clear();
+  Literals.clear();
+  Classes.clear();
+  // Every rule name first, a rule may refer to one defined below it
+  std::vector<std::string> Bodies;
+  std::vector<int> BodyLines;
+  int Line = 0;
+  for (size_t Start = 0; Start < Text.size(); Line++) {
+    size_t End = std::min(Text.find('\n', Start), Text.size());
+    std::string Current = Text.substr(Start, End - Start);
+    Start = End + 1;
+    size_t Pos = Current.find_first_not_of(" \t\r");
+    if (Pos == std::string::npos || Current[Pos] == '#') {
+      continue;
+    }
+    size_t NameEnd = Pos;
+    while (NameEnd < Current.size() && isNameChar(Current[NameEnd])) {
+      NameEnd++;
+    }
+    size_t Equal = Current.find_first_not_of(" \t", NameEnd);
+    if (NameEnd == Pos || Equal == std::string::npos || Current[Equal] != '=') {
+      fprintf(stderr, "grammar line %d: expected name = symbols\n", Line + 1);
+      Rules.clear();
+      return false;
+    }
+    GrammarRule Rule = {};
+    Rule.Name = Current.substr(Pos, NameEnd - Pos);
+    Rule.Token = isupper((unsigned char)Rule.Name[0]);
+    Rule.Hidden = Rule.Name[0] == '_';
+    Rules.push_back(Rule);
+    Bodies.push_back(Current.substr(Equal + 1));
+    BodyLines.push_back(Line + 1);
+  }
+
+  for (size_t i = 0; i < Rules.size(); i++) {
+    const std::string &Body = Bodies[i];
+    Rules[i].Alternatives.emplace_back();
+    for (size_t Pos = 0; Pos < Body.size();) {
+      if (isspace((unsigned char)Body[Pos])) {
+        Pos++;
+      } else if (Body[Pos] == '|') {
+        Rules[i].Alternatives.emplace_back();
+        Pos++;
+      } else {
+        GrammarSymbol Symbol;
+        if (!parseSymbol(Body, Pos, Symbol, BodyLines[i])) {
+          Rules.clear();
+          return false;
+        }
+        Rules[i].Alternatives.back().push_back(Symbol);
+      }
+    }
+  }
+  if (Rules.empty() || !computeHeights()) {
+    fprintf(stderr, "grammar: no usable rule\n");
+    Rules.clear();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Match Symbol once at Pos, advancing it. A rule symbol adds its nodes to
+ * Nodes, unless NULL (inside a token).
+ */
+bool Grammar::matchSymbol(const GrammarSymbol &Symbol, const std::string &Input, size_t &Pos,
+                          uint32_t Flags, int Nesting, std::vector<TreeNode> *Nodes) const {
+  switch (Symbol.Kind) {
+  case SYMBOL_LITERAL: {
+    const std::string &Literal = Literals[Symbol.Index];
+    if (Input.compare(Pos, Literal.size(), Literal)) {
+      return false;
+    }
+    Pos += Literal.size();
+    return true;
+  }
+  case SYMBOL_CLASS:
+    if (Pos >= Input.size() || !Classes[Symbol.Index].has(Input[Pos])) {
+      return false;
+    }
+    Pos++;
+    return true;
+  default:
+    return match(Symbol.Index, Input, Pos, Flags, Nesting + 1, Nodes);
+  }
+}
+
+/**
+ * Ordered choice: the first alternative that matches at Pos, backtracking
+ * over Pos and the nodes added by those that do not. Repetitions are greedy.
+ */
+bool Grammar::match(uint32_t Rule, const std::string &Input, size_t &Pos, uint32_t Flags,
+                    int Nesting, std::vector<TreeNode> *Nodes) const {
+  if (Nesting > GRAMMAR_MAX_NESTING) {
+    return false;
+  }
+  const GrammarRule &Current = Rules[Rule];
+  size_t Start = Pos;
+  bool Record = Nodes && !Current.Hidden;
+  size_t Self = Nodes ? Nodes->size() : 0;
+  if (Record) {
+    Nodes->push_back({Rule, (uint32_t)Pos, (uint32_t)Pos, Flags});
+  }
+  std::vector<TreeNode> *Inner = Current.Token ? NULL : Nodes;
+  size_t Children = Nodes ? Nodes->size() : 0;
+  for (const auto &Alternative : Current.Alternatives) {
+    bool Matched = true;
+    for (const GrammarSymbol &Symbol : Alternative) {
+      if (!Symbol.Repeat) {
+        if (!matchSymbol(Symbol, Input, Pos, 0, Nesting, Inner)) {
+          Matched = false;
+          break;
+        }
+        continue;
+      }
+      uint32_t Optional = Symbol.Repeat == '*' ? NODE_OPTIONAL | NODE_REPEATED : NODE_OPTIONAL;
+      do {
+        size_t Before = Pos;
+        // An empty match would repeat forever
+        if (!matchSymbol(Symbol, Input, Pos, Optional, Nesting, Inner) || Pos == Before) {
+          break;
+        }
+      } while (Symbol.Repeat == '*');
+    }
+    if (Matched) {
+      if (Record) {
+        (*Nodes)[Self].End = Pos;
+      }
+      return true;
+    }
+    Pos = Start;
+    if (Nodes) {
+      Nodes->resize(Children);
+    }
+  }
+  if (Nodes) {
+    Nodes->resize(Self);
+  }
+  return false;
+}
+
+void Grammar::parse(const std::string &Input, DerivationTree &Tree) const {
+  Tree.Nodes.clear();
+  size_t Pos = 0;
+  if (Input.size() <= GRAMMAR_MAX_LEN && match(0, Input, Pos, 0, 0, &Tree.Nodes) &&
+      Pos == Input.size()) {
+    Tree.State = TREE_PARSED;
+    Tree.Nodes.shrink_to_fit();
+  } else {
+    Tree.State = TREE_INVALID;
+    std::vector<TreeNode>().swap(Tree.Nodes);
+  }
+}
+
+void Grammar::generate(uint32_t Rule, int Depth, std::string &Out, Random &Rng) const {
+  if (Out.size() >= MAX_INPUT_LEN) {
+    return;
+  }
+  const GrammarRule &Current = Rules[Rule];
+  if (Current.Hidden) {
+    Depth = 0;
+  }
+  const auto &Alternative = Depth > 0
+                                ? Current.Alternatives[Rng.below(Current.Alternatives.size())]
+                                : Current.Alternatives[Current.MinAlternative];
+  for (const GrammarSymbol &Symbol : Alternative) {
+    uint64_t Count = 1;
+    if (Symbol.Repeat) {
+      Count = Depth > 0 ? Rng.below(Symbol.Repeat == '*' ? GRAMMAR_MAX_REPEAT + 1 : 2) : 0;
+    }
+    for (uint64_t i = 0; i < Count; i++) {
+      if (Symbol.Kind == SYMBOL_LITERAL) {
+        Out += Literals[Symbol.Index];
+      } else if (Symbol.Kind == SYMBOL_CLASS) {
+        const std::string &Chars = Classes[Symbol.Index].Chars;
+        Out += Chars[Rng.below(Chars.size())];
+      } else {
+        generate(Symbol.Index, Depth - 1, Out, Rng);
+      }
+    }
+  }
+}
+
+TreeMutator::TreeMutator(const Grammar &G) : G(G), Seed(NULL), Tree(NULL) {
+  Edits.reserve(1 << HAVOC_STACK_POW2);
+  Generated.reserve(MAX_INPUT_LEN);
+}
+
+void TreeMutator::start(const std::string &Seed, const DerivationTree &Tree) {
+  this->Seed = &Seed;
+  this->Tree = &Tree;
+  Edits.clear();
+  Generated.clear();
+}
+
+void TreeMutator::addEdit(const TreeNode &Node, const std::string *Source, uint32_t From,
+                          uint32_t Len, uint32_t Copies) {
+  Edits.push_back({Node.Begin, Node.End, Source, From, Len, Copies});
+}
+
+/**
+ * A random node with all of Flags, SIZE_MAX if there is none.
+ */
+size_t TreeMutator::pickNode(uint32_t Flags, Random &Rng) const {
+  const auto &Nodes = Tree->Nodes;
+  size_t Start = Rng.below(Nodes.size());
+  for (size_t i = 0; i < Nodes.size(); i++) {
+    size_t Index = (Start + i) % Nodes.size();
+    if ((Nodes[Index].Flags & Flags) == Flags) {
+      return Index;
+    }
+  }
+  return SIZE_MAX;
+}
+
+/**
+ * A random node of Rule in Tree, by reservoir sampling, NULL if there is none.
+ */
+static const TreeNode *pickOfRule(const DerivationTree &Tree, uint32_t Rule, Random &Rng) {
+  const TreeNode *Picked = NULL;
+  uint64_t Seen = 0;
+  for (const TreeNode &Node : Tree.Nodes) {
+    if (Node.Rule == Rule && Rng.below(++Seen) == 0) {
+      Picked = &Node;
+    }
+  }
+  return Picked;
+}
+
+void TreeMutator::expand(const TreeNode &Node, Random &Rng) {
+  uint32_t From = Generated.size();
+  G.generate(Node.Rule, 1 + Rng.below(GRAMMAR_EXPAND_DEPTH), Generated, Rng);
+  addEdit(Node, &Generated, From, Generated.size() - From, 1);
+}
+
+/**
+ * 0: replace a node with another of its rule in the seed, 1: in another
+ * seed, 2: with a fresh derivation of its rule, 3: repeat a node of a '*'
+ * repetition, 4: remove an optional one. Those without a candidate expand.
+ */
+void TreeMutator::mutateWith(int Operator, Random &Rng) {
+  if (Tree->Nodes.empty()) {
+    return;
+  }
+  const TreeNode &Node = Tree->Nodes[Rng.below(Tree->Nodes.size())];
+  const TreeNode *Donor = NULL;
+  const std::string *Source = Seed;
+  switch (Operator) {
+  case 0:
+    Donor = pickOfRule(*Tree, Node.Rule, Rng);
+    break;
+  case 1: {
+    const DerivationTree *Other = NULL;
+    Source = TreeSplicePartner ? TreeSplicePartner(Rng, &Other) : NULL;
+    if (Source && Other) {
+      Donor = pickOfRule(*Other, Node.Rule, Rng);
+    } else {
+      Source = Seed;
+      Donor = pickOfRule(*Tree, Node.Rule, Rng);
+    }
+    break;
+  }
+  case 3:
+  case 4: {
+    size_t Index = pickNode(Operator == 3 ? NODE_REPEATED : NODE_OPTIONAL, Rng);
+    if (Index != SIZE_MAX) {
+      const TreeNode &Picked = Tree->Nodes[Index];
+      uint32_t Copies = Operator == 3 ? 2 + Rng.below(GRAMMAR_MAX_COPIES - 1) : 0;
+      addEdit(Picked, Seed, Picked.Begin, Picked.End - Picked.Begin, Copies);
+      return;
+    }
+    break;
+  }
+  }
+  if (Donor && Donor != &Node) {
+    addEdit(Node, Source, Donor->Begin, Donor->End - Donor->Begin, 1);
+  } else {
+    expand(Node, Rng);
+  }
+}
+
+/**
+ * The seed with the edits applied left to right, those overlapping an
+ * edit already applied are dropped. Truncated to MAX_INPUT_LEN.
+ */
+void TreeMutator::finish(std::string &Mutant) {
+  std::sort(Edits.begin(), Edits.end(),
+            [](const Edit &A, const Edit &B) { return A.Begin < B.Begin; });
+  auto Append = [&Mutant](const std::string &Source, size_t From, size_t Len) {
+    Mutant.append(Source, From, std::min(Len, MAX_INPUT_LEN - Mutant.size()));
+  };
+  Mutant.clear();
+  size_t Pos = 0;
+  for (const Edit &E : Edits) {
+    if (E.Begin < Pos) {
+      continue;
+    }
+    Append(*Seed, Pos, E.Begin - Pos);
+    for (uint32_t i = 0; i < E.Copies; i++) {
+      Append(*E.Source, E.From, E.Len);
+    }
+    Pos = E.End;
+  }
+  Append(*Seed, Pos, Seed->size() - Pos);
+}
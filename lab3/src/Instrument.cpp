@@ -5,7 +5,28 @@ using namespace llvm;
 namespace instrument {
 
 static const char *SanitizerFunctionName = "__sanitize__";
-static const char *CoverageFunctionName = "__coverage__";
+static const char *CoverageMapName = "__cov_area_ptr__";
+/* Must match MAP_SIZE_POW2 in Coverage.h and lib/runtime.c */
+static const int MapSizePow2 = 16;
+static const char *ForkServerFunctionName = "__fork_server__";
+static const char *CmpLogInsFunctionName = "__cmplog_ins__";
+static const char *CmpLogRtnFunctionName = "__cmplog_rtn__";
+static const char *CmpLogEnabledName = "__cmplog_enabled_ptr__";
+/* Must match CMP_MAP_W in CmpLog.h and lib/runtime.c */
+static const unsigned int CmpMapW = 4096;
+
+static cl::opt<std::string> CoverageMode("coverage-mode",
+    cl::desc("Coverage granularity: inst (per source location), block or edge"),
+    cl::init("inst"));
+static cl::opt<std::string> CoverageMapFile("coverage-map",
+    cl::desc("Sidecar mapping coverage ids to line,col (default: <source>.covmap)"),
+    cl::init(""));
+static cl::opt<bool> CmpLog("cmplog",
+    cl::desc("Log the operands of comparisons for the fuzzer's input-to-state stage"),
+    cl::init(false));
+static cl::opt<unsigned> CoverageSeed("coverage-seed",
+    cl::desc("Seed of the random block ids, 0 picks a fresh one"),
+    cl::init(0));
 
 /*
  * Implement divide-by-zero sanitizer.
@@ -40,36 +61,306 @@ void instrumentSanitize(Module *M, Instruction &I) {
   Call->setTailCall(true);
 }
 
+/*
+ * Map slot of a source location, must match __cov_location_id__ in lib/runtime.c
+ */
+unsigned int locationId(unsigned int Line, unsigned int Col) {
+  unsigned int Key = (Line << 12) ^ Col;
+  return (Key * 2654435761u) >> (32 - MapSizePow2);
+}
+
 /*
  * Implement code coverage instrumentation.
+ * Bump the location's slot of the shared coverage map inline instead of calling into the runtime.
+ * The slot is a saturating hit counter, the fuzzer buckets it (see classifyCounts).
  */
-void instrumentCoverage(Module *M, Instruction &I) {
-  
-  const DebugLoc &Debug = I.getDebugLoc();
-  /* If the object is NULL, skip */
-  if(!Debug) {
-    return;
-  }
-  /* Load coverage function into LLVM */
+void instrumentCoverage(Module *M, Instruction &I, unsigned int Id) {
+  LLVMContext& Ctx = M->getContext();
+  /* The map pointer is defined by the runtime */
+  Constant* Map = M->getOrInsertGlobal(CoverageMapName, Type::getInt8PtrTy(Ctx));
+  IRBuilder<> Builder(&I);
+  Value* MapPtr = Builder.CreateLoad(Map);
+  Value* Slot = Builder.CreateConstInBoundsGEP1_32(Type::getInt8Ty(Ctx), MapPtr, Id);
+  Value* Counter = Builder.CreateLoad(Slot);
+  Value* Incr = Builder.CreateAdd(Counter, ConstantInt::get(Type::getInt8Ty(Ctx), 1));
+  /* Saturate at 255, wrapping to 0 would hide a loop that runs 256 times */
+  Value* Full = Builder.CreateICmpEQ(Counter, ConstantInt::get(Type::getInt8Ty(Ctx), 255));
+  Builder.CreateStore(Builder.CreateSelect(Full, Counter, Incr), Slot);
+}
+
+/*
+ * Start the fork server at the entry of main, before the target touches its input.
+ */
+void instrumentForkServer(Module *M, Function &F) {
+  LLVMContext& Ctx = M->getContext();
+  Value* NewValue = M->getOrInsertFunction(ForkServerFunctionName,
+		                           Type::getVoidTy(Ctx));
+  Function* NewFunction = cast<Function>(NewValue);
+  Instruction *InsertPt = &*F.getEntryBlock().getFirstInsertionPt();
+  CallInst *Call = CallInst::Create(NewFunction, "", InsertPt);
+  Call->setCallingConv(CallingConv::C);
+}
+
+/*
+ * Branch around the hooks of a comparison site unless the fuzzer enabled
+ * logging, so that outside the input-to-state stage a site costs two loads
+ * and a compare instead of a call. The flag pointer is defined by the
+ * runtime and points at a zero until the comparison table is attached.
+ * Returns the instruction to insert the hooks before.
+ */
+Instruction *insertCmpLogCheck(Module *M, Instruction &I) {
+  LLVMContext& Ctx = M->getContext();
+  Constant* EnabledPtr = M->getOrInsertGlobal(CmpLogEnabledName, Type::getInt32PtrTy(Ctx));
+  IRBuilder<> Builder(&I);
+  Value* Enabled = Builder.CreateLoad(Builder.CreateLoad(EnabledPtr));
+  Value* IsOn = Builder.CreateICmpNE(Enabled, ConstantInt::get(Type::getInt32Ty(Ctx), 0));
+  MDNode* Unlikely = MDBuilder(Ctx).createBranchWeights(1, 1 << 20);
+  return SplitBlockAndInsertIfThen(IsOn, &I, false, Unlikely);
+}
+
+/*
+ * Log the two integer operands of a comparison, zero-extended to 64 bits.
+ */
+void instrumentCmpLogIns(Module *M, Instruction *InsertPt, Value *A, Value *B, unsigned int Id) {
   LLVMContext& Ctx = M->getContext();
-  Value* NewValue = M->getOrInsertFunction(CoverageFunctionName,
+  Value* NewValue = M->getOrInsertFunction(CmpLogInsFunctionName,
 		                           Type::getVoidTy(Ctx),
+					   Type::getInt64Ty(Ctx),
+					   Type::getInt64Ty(Ctx),
 					   Type::getInt32Ty(Ctx),
 					   Type::getInt32Ty(Ctx));
   Function* NewFunction = cast<Function>(NewValue);
-  /* Populate arguments line, col */
+  IRBuilder<> Builder(InsertPt);
   std::vector<Value*> Args;
-  Args.push_back(ConstantInt::get(Type::getInt32Ty(Ctx), Debug.getLine(), true));
-  Args.push_back(ConstantInt::get(Type::getInt32Ty(Ctx), Debug.getCol(), true));
-  CallInst *Call = CallInst::Create(NewFunction, Args, "", &I);
+  Args.push_back(Builder.CreateZExt(A, Type::getInt64Ty(Ctx)));
+  Args.push_back(Builder.CreateZExt(B, Type::getInt64Ty(Ctx)));
+  Args.push_back(ConstantInt::get(Type::getInt32Ty(Ctx), A->getType()->getIntegerBitWidth() / 8));
+  Args.push_back(ConstantInt::get(Type::getInt32Ty(Ctx), Id));
+  CallInst *Call = CallInst::Create(NewFunction, Args, "", InsertPt);
   Call->setCallingConv(CallingConv::C);
-  Call->setTailCall(true);
+}
 
+/*
+ * Log the buffers of a strcmp- or memcmp-like call I. Len is NULL for
+ * strcmp, Strings is set for the str* calls, whose buffers end at a NUL.
+ */
+void instrumentCmpLogRtn(Module *M, CallInst &I, Instruction *InsertPt, Value *Len, bool Strings,
+                         unsigned int Id) {
+  LLVMContext& Ctx = M->getContext();
+  Value* NewValue = M->getOrInsertFunction(CmpLogRtnFunctionName,
+		                           Type::getVoidTy(Ctx),
+					   Type::getInt8PtrTy(Ctx),
+					   Type::getInt8PtrTy(Ctx),
+					   Type::getInt64Ty(Ctx),
+					   Type::getInt32Ty(Ctx),
+					   Type::getInt32Ty(Ctx));
+  Function* NewFunction = cast<Function>(NewValue);
+  IRBuilder<> Builder(InsertPt);
+  std::vector<Value*> Args;
+  Args.push_back(Builder.CreatePointerCast(I.getArgOperand(0), Type::getInt8PtrTy(Ctx)));
+  Args.push_back(Builder.CreatePointerCast(I.getArgOperand(1), Type::getInt8PtrTy(Ctx)));
+  Args.push_back(Len ? Builder.CreateZExtOrTrunc(Len, Type::getInt64Ty(Ctx))
+                     : ConstantInt::get(Type::getInt64Ty(Ctx), -1, true));
+  Args.push_back(ConstantInt::get(Type::getInt32Ty(Ctx), Strings));
+  Args.push_back(ConstantInt::get(Type::getInt32Ty(Ctx), Id));
+  CallInst *Call = CallInst::Create(NewFunction, Args, "", InsertPt);
+  Call->setCallingConv(CallingConv::C);
+}
+
+/*
+ * Only 1, 2, 4 and 8-byte integers can be found and patched in the input.
+ */
+bool isLoggedWidth(Type *T) {
+  if(!T->isIntegerTy()) {
+    return false;
+  }
+  unsigned int Width = T->getIntegerBitWidth();
+  return Width == 8 || Width == 16 || Width == 32 || Width == 64;
+}
+
+/*
+ * Comparison sites of the program, collected before any instrumentation so
+ * that the pass's own compares (counter saturation, cmplog checks) are not
+ * logged.
+ */
+std::vector<Instruction*> cmpLogSites(Function &F) {
+  std::vector<Instruction*> Sites;
+  for (inst_iterator It = inst_begin(F), E = inst_end(F); It != E; ++It) {
+    if(isa<ICmpInst>(*It) || isa<SwitchInst>(*It) || isa<CallInst>(*It)) {
+      Sites.push_back(&*It);
+    }
+  }
+  return Sites;
+}
+
+/*
+ * CmpLog: hook icmp and switch instructions and strcmp/memcmp-like calls,
+ * each site with a random id in the runtime's comparison table.
+ */
+void Instrument::instrumentCmpLog(Function &F, std::vector<Instruction*> &Sites) {
+  Module* ParentModule = F.getParent();
+  std::uniform_int_distribution<unsigned int> RandomId(0, CmpMapW - 1);
+  for (Instruction *I : Sites) {
+    if(ICmpInst *Cmp = dyn_cast<ICmpInst>(I)) {
+      Value *A = Cmp->getOperand(0), *B = Cmp->getOperand(1);
+      if(isLoggedWidth(A->getType()) && !(isa<Constant>(A) && isa<Constant>(B))) {
+        instrumentCmpLogIns(ParentModule, insertCmpLogCheck(ParentModule, *Cmp), A, B,
+                            RandomId(Rng));
+      }
+    } else if(SwitchInst *Switch = dyn_cast<SwitchInst>(I)) {
+      Value *Cond = Switch->getCondition();
+      if(!isLoggedWidth(Cond->getType()) || isa<Constant>(Cond) || !Switch->getNumCases()) {
+        continue;
+      }
+      /* One check for all the cases */
+      Instruction *InsertPt = insertCmpLogCheck(ParentModule, *Switch);
+      for (auto Case : Switch->cases()) {
+        instrumentCmpLogIns(ParentModule, InsertPt, Cond, Case.getCaseValue(), RandomId(Rng));
+      }
+    } else {
+      CallInst *Call = cast<CallInst>(I);
+      Function *Callee = Call->getCalledFunction();
+      if(!Callee) {
+        continue;
+      }
+      StringRef Name = Callee->getName();
+      bool Strings = Name == "strcmp" || Name == "strcasecmp" || Name == "strncmp" ||
+                     Name == "strncasecmp";
+      bool Bounded = Name == "strncmp" || Name == "strncasecmp" || Name == "memcmp" ||
+                     Name == "bcmp";
+      if(Strings || Bounded) {
+        instrumentCmpLogRtn(ParentModule, *Call, insertCmpLogCheck(ParentModule, *Call),
+                            Bounded ? Call->getArgOperand(2) : nullptr, Strings, RandomId(Rng));
+      }
+    }
+  }
+}
+
+/*
+ * Whether the execution may end between From and the terminator of its
+ * block. Post-dominance only knows of calls marked noreturn. Any other call,
+ * but to an intrinsic, may still exit, abort or longjmp (__sanitize__ does
+ * in persistent mode). All three write memory, a call that only reads it
+ * (strlen, strcmp...) returns.
+ */
+bool mayNotReturn(BasicBlock::iterator From) {
+  for (BasicBlock::iterator It = From, E = From->getParent()->end(); It != E; ++It) {
+    if(isa<IntrinsicInst>(*It)) {
+      continue;
+    }
+    if(CallInst *Call = dyn_cast<CallInst>(&*It)) {
+      if(!Call->onlyReadsMemory()) {
+        return true;
+      }
+    } else if(isa<InvokeInst>(*It)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Whether BB needs a counter of its own. A block that post-dominates its
+ * immediate dominator runs exactly when the dominator does, so its coverage
+ * is implied by the dominator's counter. Unless a call on the way, in the
+ * dominator after its counter or in a block between the two, may not return.
+ */
+bool needsCounter(BasicBlock *BB, DominatorTree &DT, PostDominatorTree &PDT) {
+  DomTreeNode *Node = DT.getNode(BB);
+  if(!Node || !Node->getIDom()) {
+    return true;
+  }
+  BasicBlock *IDom = Node->getIDom()->getBlock();
+  if(!PDT.dominates(BB, IDom)) {
+    return true;
+  }
+  /* Every path from the dominator runs into BB, walk them up to it */
+  std::vector<BasicBlock*> Worklist(1, IDom);
+  std::set<BasicBlock*> Visited(Worklist.begin(), Worklist.end());
+  while (!Worklist.empty()) {
+    BasicBlock *Block = Worklist.back();
+    Worklist.pop_back();
+    /* Counters go at the first insertion point, what comes before runs either way */
+    if(mayNotReturn(Block->getFirstInsertionPt())) {
+      return true;
+    }
+    for (BasicBlock *Succ : successors(Block)) {
+      if(Succ != BB && Visited.insert(Succ).second) {
+        Worklist.push_back(Succ);
+      }
+    }
+  }
+  return false;
+}
+
+/*
+ * Block and edge modes: one inline counter per block with a random id.
+ * Edge mode first splits critical edges so that every CFG edge owns a block.
+ */
+void Instrument::instrumentBlocks(Function &F) {
+  Module* ParentModule = F.getParent();
+  if(CoverageMode == "edge") {
+    for (BasicBlock &BB : F) {
+      Instruction *TI = BB.getTerminator();
+      for (unsigned int i = 0; i < TI->getNumSuccessors(); i++) {
+        SplitCriticalEdge(TI, i);
+      }
+    }
+  }
+  DominatorTree DT(F);
+  PostDominatorTree PDT(F);
+
+  std::map<BasicBlock*, unsigned int> BlockIds;
+  std::uniform_int_distribution<unsigned int> RandomId(0, (1 << MapSizePow2) - 1);
+  for (BasicBlock &BB : F) {
+    if(needsCounter(&BB, DT, PDT)) {
+      BlockIds[&BB] = RandomId(Rng);
+      instrumentCoverage(ParentModule, *BB.getFirstInsertionPt(), BlockIds[&BB]);
+    }
+  }
+  /* Dominators come first in the tree walk, so implied blocks find their id ready */
+  for (auto *Node : depth_first(DT.getRootNode())) {
+    BasicBlock *BB = Node->getBlock();
+    if(!BlockIds.count(BB)) {
+      BlockIds[BB] = BlockIds[Node->getIDom()->getBlock()];
+    }
+    for (Instruction &I : *BB) {
+      if(const DebugLoc &Debug = I.getDebugLoc()) {
+        CoverageMap.insert(std::make_tuple(BlockIds[BB], Debug.getLine(), Debug.getCol()));
+      }
+    }
+  }
+}
+
+bool Instrument::doInitialization(Module &M) {
+  Rng.seed(CoverageSeed ? CoverageSeed.getValue() : std::random_device()());
+  return false;
 }
 
 bool Instrument::runOnFunction(Function &F) {
   /* Function inherits this method to get the Module from GlobalValue parent class */
   Module* ParentModule = F.getParent ();
+  std::vector<Instruction*> CmpSites;
+  if(CmpLog) {
+    CmpSites = cmpLogSites(F);
+  }
+  if(CoverageMode != "inst") {
+    for (inst_iterator It = inst_begin(F), E = inst_end(F); It != E; ++It){
+      if(It->getOpcode() == Instruction::SDiv || It->getOpcode() == Instruction::UDiv) {
+        instrumentSanitize(ParentModule, *It);
+      }
+    }
+    instrumentBlocks(F);
+    if(CmpLog) {
+      instrumentCmpLog(F, CmpSites);
+    }
+    if(F.getName() == "main") {
+      instrumentForkServer(ParentModule, F);
+    }
+    return true;
+  }
+  BasicBlock* CurrentBlock = nullptr;
+  std::set<unsigned int> BlockLocations;
   for (inst_iterator It = inst_begin(F), E = inst_end(F); It != E; ++It){
     /* Check if it belongs to div related operations as per https://piazza.com/class/kdtbmqthpx22d?cid=47
      * Unlike lab2, I only checks udiv and sdiv here since we only care about / operators
@@ -80,11 +371,46 @@ bool Instrument::runOnFunction(Function &F) {
     if(It->getOpcode() == Instruction::SDiv || It->getOpcode() == Instruction::UDiv) {
       instrumentSanitize(ParentModule, *It);
     }
-    instrumentCoverage(ParentModule, *It);
+    /* One update per location and block is enough, the rest run whenever the first does */
+    if(It->getParent() != CurrentBlock) {
+      CurrentBlock = It->getParent();
+      BlockLocations.clear();
+    }
+    const DebugLoc &Debug = It->getDebugLoc();
+    if(!Debug) {
+      continue;
+    }
+    unsigned int Id = locationId(Debug.getLine(), Debug.getCol());
+    if(BlockLocations.insert(Id).second) {
+      instrumentCoverage(ParentModule, *It, Id);
+    }
+    CoverageMap.insert(std::make_tuple(Id, Debug.getLine(), Debug.getCol()));
   }    
+  if(CmpLog) {
+    instrumentCmpLog(F, CmpSites);
+  }
+  if(F.getName() == "main") {
+    instrumentForkServer(ParentModule, F);
+  }
   return true;
 }
 
+/*
+ * Write the sidecar so that covered ids can be reported as line,col again.
+ */
+bool Instrument::doFinalization(Module &M) {
+  std::string Path = CoverageMapFile;
+  if(Path.empty()) {
+    Path = M.getSourceFileName();
+    Path = Path.substr(0, Path.rfind('.')) + ".covmap";
+  }
+  std::ofstream MapFile(Path);
+  for (auto &Entry : CoverageMap) {
+    MapFile << std::get<0>(Entry) << "," << std::get<1>(Entry) << "," << std::get<2>(Entry) << "\n";
+  }
+  return false;
+}
+
 char Instrument::ID = 1;
 static RegisterPass<Instrument>
     X("Instrument", "Instrumentations for Dynamic Analysis", false, false);
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "Coverage.h"
+#include "Stats.h"
+
+/*
+ * Reads the stats files of a fuzzer while it runs, or after: one line per
+ * worker and the total, operator yield and crash buckets over all workers.
+ * usage: monitor [output dir]
+ */
+
+static const FuzzerStats *mapForReading(const std::string &Path) {
+  int Fd = open(Path.c_str(), O_RDONLY);
+  if (Fd < 0) {
+    return NULL;
+  }
+  void *Map = mmap(NULL, sizeof(FuzzerStats), PROT_READ, MAP_SHARED, Fd, 0);
+  close(Fd);
+  if (Map == MAP_FAILED) {
+    return NULL;
+  }
+  const FuzzerStats *Stats = (const FuzzerStats *)Map;
+  if (Stats->Magic != STATS_MAGIC || Stats->Version != STATS_VERSION) {
+    fprintf(stderr, "%s: not a stats file of this version\n", Path.c_str());
+    munmap(Map, sizeof(FuzzerStats));
+    return NULL;
+  }
+  return Stats;
+}
+
+static void printWorker(const char *Label, const FuzzerStats &S, bool Alive) {
+  double Seconds = (S.RefreshMs - S.StartMs) / 1000.0;
+  printf("%-6s %-5s %8.0f %12lu %10.1f %9.1f %7lu %9lu %8.2f %8lu %7lu %7lu %6.2f\n", Label,
+         Alive ? "run" : "done", Seconds, (unsigned long)S.NumExecs, S.ExecsPerSec,
+         S.NumExecs ? (double)S.TotalExecUs / S.NumExecs : 0.0, (unsigned long)S.NumSeeds,
+         (unsigned long)S.CoveragePoints, S.Stability, (unsigned long)S.NumCrashes,
+         (unsigned long)S.NumBuckets, (unsigned long)S.NumHangs,
+         S.NumMutants ? 100.0 * S.NumDuplicates / S.NumMutants : 0.0);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("usage %s [output dir]\n", argv[0]);
+    return 1;
+  }
+  std::string OutDir(argv[1]);
+  std::vector<const FuzzerStats *> Workers;
+  for (int Worker = 0;; Worker++) {
+    std::string Path = OutDir + "/fuzzer_stats";
+    if (Worker > 0) {
+      Path += "." + std::to_string(Worker);
+    }
+    const FuzzerStats *Stats = mapForReading(Path);
+    if (!Stats) {
+      break;
+    }
+    Workers.push_back(Stats);
+  }
+  if (Workers.empty()) {
+    fprintf(stderr, "No stats in %s\n", OutDir.c_str());
+    return 1;
+  }
+
+  printf("%-6s %-5s %8s %12s %10s %9s %7s %9s %8s %8s %7s %7s %6s\n", "worker", "state",
+         "time s", "execs", "execs/s", "exec us", "seeds", "coverage", "stable %", "crashes",
+         "unique", "hangs", "dup %");
+  FuzzerStats Total;
+  memset(&Total, 0, sizeof(Total));
+  Total.StartMs = UINT64_MAX;
+  double Stability = 0;
+  bool AnyAlive = false;
+  for (size_t w = 0; w < Workers.size(); w++) {
+    const FuzzerStats &S = *Workers[w];
+    bool Alive = !kill(S.Pid, 0) || errno == EPERM;
+    AnyAlive |= Alive;
+    printWorker(std::to_string(w).c_str(), S, Alive);
+    Total.StartMs = std::min(Total.StartMs, S.StartMs);
+    Total.RefreshMs = std::max(Total.RefreshMs, S.RefreshMs);
+    Total.NumExecs += S.NumExecs;
+    Total.TotalExecUs += S.TotalExecUs;
+    Total.ExecsPerSec += S.ExecsPerSec;
+    Total.NumMutants += S.NumMutants;
+    Total.NumDuplicates += S.NumDuplicates;
+    Total.NumCrashes += S.NumCrashes;
+    Total.NumHangs += S.NumHangs;
+    // Shared between the workers: seeds get published to all, the virgin map is common
+    Total.NumSeeds = std::max(Total.NumSeeds, S.NumSeeds);
+    Total.CoveragePoints = std::max(Total.CoveragePoints, S.CoveragePoints);
+    Stability += S.Stability / Workers.size();
+    for (int i = 0; i < NUM_MUTATION_METHODS; i++) {
+      Total.OperatorUses[i] += S.OperatorUses[i];
+      Total.OperatorFinds[i] += S.OperatorFinds[i];
+      Total.OperatorCrashes[i] += S.OperatorCrashes[i];
+    }
+  }
+
+  // Buckets are named the same by every worker
+  std::map<uint64_t, BucketStats> Buckets;
+  for (const FuzzerStats *S : Workers) {
+    for (uint64_t i = 0; i < std::min<uint64_t>(S->NumBuckets, STATS_MAX_BUCKETS); i++) {
+      const BucketStats &B = S->Buckets[i];
+      auto It = Buckets.find(B.Signature);
+      if (It == Buckets.end()) {
+        Buckets[B.Signature] = B;
+      } else {
+        It->second.Count += B.Count;
+      }
+    }
+  }
+  Total.NumBuckets = Buckets.size();
+  Total.Stability = Stability;
+  if (Workers.size() > 1) {
+    printWorker("all", Total, AnyAlive);
+  }
+
+  printf("\n%-16s %12s %10s %10s %12s\n", "operator", "uses", "finds", "crashes",
+         "finds/1k");
+  for (int i = 0; i < NUM_MUTATION_METHODS; i++) {
+    printf("%-16s %12lu %10lu %10lu %12.3f\n", MutationNames[i],
+           (unsigned long)Total.OperatorUses[i], (unsigned long)Total.OperatorFinds[i],
+           (unsigned long)Total.OperatorCrashes[i],
+           Total.OperatorUses[i] ? 1000.0 * Total.OperatorFinds[i] / Total.OperatorUses[i] : 0.0);
+  }
+
+  if (!Buckets.empty()) {
+    printf("\n%-16s %-24s %10s\n", "bucket", "crash", "count");
+    for (auto &Entry : Buckets) {
+      const BucketStats &B = Entry.second;
+      char What[32];
+      if (B.Kind == CRASH_SANITIZER) {
+        snprintf(What, sizeof(What), "sanitizer %d:%d", B.Line, B.Col);
+      } else if (B.Kind == CRASH_SIGNAL) {
+        snprintf(What, sizeof(What), "signal %u", B.Signal);
+      } else {
+        snprintf(What, sizeof(What), "no report");
+      }
+      printf("%016lx %-24s %10lu\n", (unsigned long)B.Signature, What, (unsigned long)B.Count);
+    }
+  }
+  return 0;
+}
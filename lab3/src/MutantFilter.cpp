@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Checkpoint.h"
+#include "MutantFilter.h"
+
+// A block is one 64-byte cache line
+#define BLOCK_WORDS 8
+#define BLOCK_BITS (BLOCK_WORDS * 64)
+
+MutantFilter::MutantFilter(size_t Bytes, double FalsePositiveRate)
+    : NumDuplicates(0), NumInserted(0), NumRebuilds(0), NumSetBits(0), Mapped(false) {
+  NumBlocks = Bytes / (BLOCK_WORDS * 8);
+  // calloc leaves the pages unbacked until a mutant lands in them
+  Blocks = (uint64_t *)calloc(NumBlocks * BLOCK_WORDS, sizeof(uint64_t));
+  // Optimal Bloom parameters: k = -log2(p) probes and k / ln 2 bits per mutant.
+  // Uneven block loads cost a blocked filter about a third of that capacity.
+  NumProbes = std::max(1, (int)std::lround(-std::log2(FalsePositiveRate)));
+  Capacity = (uint64_t)(NumBlocks * BLOCK_BITS * std::log(2.0) / NumProbes * 2 / 3);
+}
+
+MutantFilter::~MutantFilter() {
+  if (Mapped) {
+    munmap(Blocks, NumBlocks * BLOCK_WORDS * sizeof(uint64_t));
+  } else {
+    free(Blocks);
+  }
+}
+
+/*
+ * Mapped shared, the kernel writes the blocks back as they change and a
+ * checkpoint never copies the filter. The file may be ahead of the last
+ * checkpoint: it then holds mutants tried since, that are only skipped.
+ * Called before the first insert, the bits in memory are dropped.
+ */
+bool MutantFilter::mapFile(const std::string &Path, bool Keep) {
+  size_t Bytes = NumBlocks * BLOCK_WORDS * sizeof(uint64_t);
+  int Fd = open(Path.c_str(), O_RDWR | O_CREAT, 0644);
+  struct stat Buffer;
+  if (Fd < 0 || fstat(Fd, &Buffer)) {
+    perror(Path.c_str());
+    return false;
+  }
+  // A file of another size has bits in other places
+  if ((!Keep || (size_t)Buffer.st_size != Bytes) && ftruncate(Fd, 0)) {
+    perror(Path.c_str());
+    close(Fd);
+    return false;
+  }
+  void *Map = MAP_FAILED;
+  if (!ftruncate(Fd, Bytes)) {
+    Map = mmap(NULL, Bytes, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+  }
+  close(Fd);
+  if (Map == MAP_FAILED) {
+    perror(Path.c_str());
+    return false;
+  }
+  free(Blocks);
+  Blocks = (uint64_t *)Map;
+  Mapped = true;
+  return true;
+}
+
+void MutantFilter::save(FILE *F) const {
+  uint64_t Counters[4] = {NumDuplicates, NumInserted, NumRebuilds, NumSetBits};
+  writeRaw(F, Counters, 4);
+}
+
+bool MutantFilter::load(FILE *F) {
+  uint64_t Counters[4];
+  if (!readRaw(F, Counters, 4)) {
+    return false;
+  }
+  NumDuplicates = Counters[0];
+  NumInserted = Counters[1];
+  NumRebuilds = Counters[2];
+  NumSetBits = Counters[3];
+  return true;
+}
+
+/*
+ * Block and bit positions come from one 64-bit hash: the high half picks
+ * the block, double hashing on the low half picks the bits in it.
+ */
+bool MutantFilter::contains(const std::string &Mutant) {
+  uint64_t Hash = std::hash<std::string>()(Mutant);
+  uint64_t *Block = &Blocks[(Hash >> 32) % NumBlocks * BLOCK_WORDS];
+  uint32_t H1 = Hash, H2 = (Hash >> 17) | 1;
+  for (int i = 0; i < NumProbes; i++) {
+    uint32_t Bit = (H1 + i * H2) % BLOCK_BITS;
+    if (!(Block[Bit / 64] & (1ULL << (Bit % 64)))) {
+      return false;
+    }
+  }
+  NumDuplicates++;
+  return true;
+}
+
+void MutantFilter::insert(const std::string &Mutant) {
+  if (NumInserted >= Capacity) {
+    // Past this point the false-positive rate would exceed the target
+    memset(Blocks, 0, NumBlocks * BLOCK_WORDS * sizeof(uint64_t));
+    NumInserted = NumSetBits = 0;
+    NumRebuilds++;
+  }
+  uint64_t Hash = std::hash<std::string>()(Mutant);
+  uint64_t *Block = &Blocks[(Hash >> 32) % NumBlocks * BLOCK_WORDS];
+  uint32_t H1 = Hash, H2 = (Hash >> 17) | 1;
+  for (int i = 0; i < NumProbes; i++) {
+    uint32_t Bit = (H1 + i * H2) % BLOCK_BITS;
+    uint64_t Mask = 1ULL << (Bit % 64);
+    NumSetBits += !(Block[Bit / 64] & Mask);
+    Block[Bit / 64] |= Mask;
+  }
+  NumInserted++;
+}
+
+double MutantFilter::fillRatio() const {
+  return (double)NumSetBits / (NumBlocks * BLOCK_BITS);
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <sys/stat.h>
@@ -8,189 +9,174 @@
 
 #include <cstring>
 #include <cstdio>
+#include <chrono>
 
+#include "Bandit.h"
+#include "Checkpoint.h"
+#include "CmpLog.h"
+#include "Coverage.h"
+#include "Deterministic.h"
+#include "Dictionary.h"
+#include "Grammar.h"
+#include "MutantFilter.h"
+#include "Mutator.h"
+#include "Parallel.h"
+#include "Persistent.h"
+#include "Random.h"
+#include "Scheduler.h"
+#include "Stats.h"
+#include "Triage.h"
 #include "Utils.h"
 
 // Uncomment to show debug messages
 // #define DEBUG
 // Though some cost to check duplicates, yet the unique number of mutants tried in fixed time is larger during measurement
 #define AVOID_DUPLICATE_MUTANT
+// Comment to fall back to the <target>.cov text file written by the runtime
+#define SHM_COVERAGE
 
 std::vector<std::string> SeedInputs;
-std::vector<std::string> PastCoverage;
-#include <unordered_map>
+CoverageSet PastCoverage;
 #define REPORT_PERIOD 1000
-std::unordered_map<std::string, int> PastMutantMemo;
+MutantFilter PastMutantMemo(MUTANT_FILTER_BYTES, MUTANT_FILTER_FP_RATE);
 int NumDuplicateMutant = 0;
 int NumTriedMutant = 0;
+// Every random decision of this worker, seeded in main
+Random Rng(0);
+// Picks the seed to mutate, schedule set with -p in main
+Scheduler Sched(SCHEDULE_FAST);
+// Wall time of the last execution of the target, and what it came to
+uint64_t LastExecUs = 0;
+RunResult LastResult = RESULT_OK;
+// Adaptive choice of the operators and of how many are stacked per mutant
+Bandit OperatorBandit(NUM_MUTATION_METHODS);
+Bandit StackBandit(HAVOC_STACK_POW2);
+const char *const StackNames[HAVOC_STACK_POW2] = {"stack-1", "stack-2", "stack-4", "stack-8"};
+// Structured mutations with -g: derivation trees of the seeds, parsed on
+// their first selection, and whether a mutant of a parsed seed is made on
+// its bytes or on its tree, and with which tree operators
+Grammar InputGrammar;
+std::vector<DerivationTree> SeedTrees;
+TreeMutator Trees(InputGrammar);
+Bandit LevelBandit(2);
+Bandit TreeBandit(NUM_TREE_MUTATIONS);
+const char *const LevelNames[2] = {"havoc", "tree"};
+// Tree mutants tried in a row before a duplicate gets a byte-level operator
+#define TREE_RETRIES 8
+// Mutants between two writes of <output dir>/operator_stats and crash_buckets
+#define STATS_PERIOD 10000
+// Crashes grouped by where they happened, only the smallest input of each is kept
+CrashTriage Triage;
+// Live counters in <output dir>/fuzzer_stats, a dummy until main maps the file
+FuzzerStats NoStats;
+FuzzerStats *Stats = &NoStats;
+// Map entries that took a different bucket on a second run of a seed
+uint8_t VariableBits[MAP_SIZE];
+// Executions at the last refresh of the stats
+uint64_t LastRefreshExecs = 0;
+// Taken every CHECKPOINT_SECONDS, resumed from with --resume
+Checkpoint Ckpt;
 
 /**
- * Select a seed from SeedInputs
+ * Second parent for the splice operator, as picked by the scheduler.
  */
-std::string selectInput() {
-  // Select a random seed from SeedInputs as the candidate
-  // Note, for this algorithm, once a seed is added, we never remove it so we can't just use the back
-  int Index = rand()%SeedInputs.size();
-  return SeedInputs[Index];
+const std::string *pickSplicePartner(Random &Rng) {
+  size_t Other = Sched.partner(Rng);
+  return Other < SeedInputs.size() ? &SeedInputs[Other] : NULL;
 }
 
-/*********************************************/
-/*  Mutation algorithms	 */
-/*********************************************/
-
-#define NUM_MUTATION_METHODS 7 
-#define ASCII_NUM 256
-
 /**
- * 1: Replace bytes with random values
+ * Derivation tree of seed Index, NULL if it does not parse. The trees of
+ * every seed are allocated at once, so that one stays put while the tree
+ * of a splice partner is parsed.
  */
-std::string mutateReplace(std::string Origin) {
-  // For more effective mutation, replace all bytes (rather than just a single random byte)
-  for(int Index=0; Index<Origin.size(); Index++) {
-    // Randomly generate a char different from the original
-    int RndChar = rand()%ASCII_NUM;
-    while(RndChar==Origin[Index]) {
-      RndChar = rand()%ASCII_NUM;
-    }
-    Origin[Index] = RndChar;
+const DerivationTree *treeOf(size_t Index) {
+  if (SeedTrees.size() < SeedInputs.size()) {
+    SeedTrees.resize(SeedInputs.size());
   }
-  return Origin;
-}
-
-/**
- * 2: Swap adjacent bytes
- */
-std::string mutateSwapAdjacent(std::string Origin) {
-  for(int Times=0; Times<Origin.size(); Times++) {
-    // Randomly pick a swap point
-    int Index = rand()%Origin.size();
-    if(Index==Origin.size()-1) {
-      char tmp = Origin[Index];
-      Origin[Index] = Origin[0];
-      Origin[0] = tmp; 
-    } else {
-      char tmp = Origin[Index];
-      Origin[Index] = Origin[Index+1];
-      Origin[Index+1] = tmp;
-    }
+  DerivationTree &Tree = SeedTrees[Index];
+  if (Tree.State == TREE_UNPARSED) {
+    InputGrammar.parse(SeedInputs[Index], Tree);
   }
-  return Origin;  
-}
-
-/**
- * 3: Cycle through all values of each byte
- */
-std::string mutateCycle(std::string Origin) {
-  int Shift = rand()%(Origin.size()-1)+1;
-  // Substring from Shift to end
-  std::string RetString = Origin.substr(Shift);
-  // Substring from start to Shift
-  RetString += Origin.substr(0, Shift);
-  return RetString;
-}
-
-/**
- * 4: Remove a random byte
- */
-std::string mutateRemove(std::string Origin) {
-  // Choose a random index
-  Origin.erase(Origin.begin()+rand()%Origin.size());
-  return Origin;
-}
-
-/**
- * 5: Insert a random byte
- */
-std::string mutateInsert(std::string Origin) {
-  // Randomly choose an index to insert, note we could also insert at idex Origin.size() (Origin.size()+1 options)
-  int Index = rand()%(Origin.size()+1);
-  // Randomly generate a char
-  auto RndChar = rand()%ASCII_NUM;
-  Origin.insert(Index, 1, RndChar);
-  return Origin;
+  return Tree.State == TREE_PARSED && !Tree.Nodes.empty() ? &Tree : NULL;
 }
 
 /**
- * 6: Multiple calls of mutateRemove
+ * Second parent for the tree splice operator, its tree NULL if it does not parse.
  */
-std::string mutateRemoveMultiple(std::string Origin) {
-  int NumCall = rand()%(Origin.size()/2);
-  for(int i=0; i<NumCall; i++) {
-    Origin = mutateRemove(Origin);
+const std::string *pickTreePartner(Random &Rng, const DerivationTree **Tree) {
+  size_t Other = Sched.partner(Rng);
+  if (Other >= SeedInputs.size()) {
+    return NULL;
   }
-  return Origin;
+  *Tree = treeOf(Other);
+  return &SeedInputs[Other];
 }
 
-/**
- * 7: Multiple calls of mutateInsert
- */
-std::string mutateInsertMultiple(std::string Origin) {
-  int NumCall = rand()%Origin.size();
-  for(int i=0; i<NumCall; i++) {
-    Origin = mutateInsert(Origin);
-  }
-  return Origin;
-}
+/*********************************************/
+/*  Mutation algorithms	 */
+/*********************************************/
 
 /**
- * Given string Origin, return a mutate string.
+ * Mutate seed Index into Mutant (see Mutator.h and Grammar.h).
  */
-std::string mutate(std::string Origin) {
-  int opt = rand() % NUM_MUTATION_METHODS;
-  // Make sure the mutant hasn't beed tried before
-  if(opt==0) {
-    Origin = mutateReplace(Origin);
-  } else if(opt==1) {
-    Origin = mutateSwapAdjacent(Origin);
-  } else if(opt==2) {
-    Origin = mutateCycle(Origin);
-  } else if(opt==3) {
-    Origin = mutateRemove(Origin);
-  } else if(opt==4) {
-    Origin = mutateInsert(Origin);
-  } else if(opt==5) {
-    Origin = mutateRemoveMultiple(Origin);
-  } else if(opt==6) {
-    Origin = mutateInsertMultiple(Origin);
+void mutate(size_t Index, std::string &Mutant) {
+  // Havoc or tree-level, with the stacking depth and the operators picked by the bandits
+  const DerivationTree *Tree = InputGrammar.loaded() ? treeOf(Index) : NULL;
+  bool TreeLevel = Tree && LevelBandit.pick(Rng);
+  int NumStacked = 1 << StackBandit.pick(Rng);
+  if (TreeLevel) {
+    Trees.start(SeedInputs[Index], *Tree);
+    for (int i = 0; i < NumStacked; i++) {
+      Trees.mutateWith(TreeBandit.pick(Rng), Rng);
+    }
+    Trees.finish(Mutant);
+  } else {
+    Mutant.assign(SeedInputs[Index]);
+    for (int i = 0; i < NumStacked; i++) {
+      mutateWith(OperatorBandit.pick(Rng), Mutant, Rng);
+    }
   }
 #ifdef AVOID_DUPLICATE_MUTANT
-  while(PastMutantMemo.find(Origin)!=PastMutantMemo.end()) {
+  // Make sure the mutant hasn't beed tried before
+  for (int Retries = 0; PastMutantMemo.contains(Mutant); Retries++) {
     NumDuplicateMutant += 1;
-    opt = rand() % NUM_MUTATION_METHODS;
-    if(opt==0) {
-      Origin = mutateReplace(Origin);
-    } else if(opt==1) {
-      Origin = mutateSwapAdjacent(Origin);
-    } else if(opt==2) {
-      Origin = mutateCycle(Origin);
-    } else if(opt==3) {
-      Origin = mutateRemove(Origin);
-    } else if(opt==4) {
-      Origin = mutateInsert(Origin);
-    } else if(opt==5) {
-      Origin = mutateRemoveMultiple(Origin);
-    } else if(opt==6) {
-      Origin = mutateInsertMultiple(Origin);
+    if (TreeLevel && Retries < TREE_RETRIES) {
+      // One more edit on the tree, the mutant is rewritten from the seed
+      Trees.mutateWith(TreeBandit.pick(Rng), Rng);
+      Trees.finish(Mutant);
+    } else {
+      mutateWith(OperatorBandit.pick(Rng), Mutant, Rng);
     }
   }
-  PastMutantMemo.insert({Origin, 0});
+  PastMutantMemo.insert(Mutant);
 #endif
-  return Origin;
 }
 
 /*********************************************/
 /* 		Implement your feedback algorithm	 */
 /*********************************************/
 
-void feedBack(std::string &Target, std::string &Mutated) {
+/**
+ * Whether the last execution covered anything new, recording it as covered.
+ */
+bool checkCoverage(std::string &Target) {
+#ifdef SHM_COVERAGE
+  Sched.recordExecution(TraceBits);
+  bool NewCoverage = hasNewCoverage(VirginBits);
+#ifdef DEBUG
+  if(NewCoverage) {
+    std::cout << "[DEBUG-cov] " << countCoverage(VirginBits) << " points" << std::endl;
+  }
+#endif
+#else
   std::string CovPath = Target+".cov";
   std::ifstream CovFile(CovPath);
   std::string Line;
   bool NewCoverage = false;
   if(CovFile.is_open()) {
     while(std::getline(CovFile,Line)) {
-      if(std::find(PastCoverage.begin(), PastCoverage.end(), Line)==PastCoverage.end()) {
-        PastCoverage.push_back(Line);
+      if(PastCoverage.insert(coverageKey(Line))) {
 #ifdef DEBUG
 	std::cout << "[DEBUG-cov] " << Line << std::endl;
 #endif
@@ -199,16 +185,34 @@ void feedBack(std::string &Target, std::string &Mutated) {
     }
     CovFile.close();
   }
+#endif
+  return NewCoverage;
+}
+
+bool feedBack(std::string &Target, std::string &Mutated) {
+  // A hang would stall every visit of it as a seed, test keeps it apart
+  if (LastResult == RESULT_TIMEOUT) {
+    return false;
+  }
+  bool NewCoverage = checkCoverage(Target);
   if(NewCoverage) {
 #ifdef DEBUG
     std::cout << "[DEBUG-SeedInputs size before add] " << SeedInputs.size() << std::endl; 
 #endif
     SeedInputs.push_back(Mutated);
+    publishSeed(Mutated);
+    Sched.creditChild();
+#ifdef SHM_COVERAGE
+    Sched.addSeed(Mutated.size(), LastExecUs, TraceBits);
+#else
+    Sched.addSeed(Mutated.size(), LastExecUs, NULL);
+#endif
   } else {
-    if(rand()%1000<1) {
+    if(Rng.below(1000)<1) {
   // SeedInputs.push_back(Mutated); 
     }
   }
+  return NewCoverage;
 }
 
 /*****************************************************************/
@@ -223,6 +227,9 @@ int readSeedInputs(std::string &SeedInputDir) {
         continue;
       std::string Path = SeedInputDir + "/" + std::string(Ent->d_name);
       std::string Line = readOneFile(Path);
+      if (Line.size() > MAX_INPUT_LEN) {
+        Line.resize(MAX_INPUT_LEN);
+      }
       SeedInputs.push_back(Line);
     }
     closedir(Directory);
@@ -234,29 +241,389 @@ int readSeedInputs(std::string &SeedInputDir) {
 
 int Freq = 1000;
 int Count = 0;
+// Hangs kept so far, at most MAX_HANGS (they can't all be told apart)
+#define MAX_HANGS 500
+int NumHangs = 0;
 
-bool test(std::string &Target, std::string &Input, std::string &OutDir) {
+/**
+ * Run Input once, leaving its coverage behind. Returns the wait status.
+ */
+int execute(std::string &Target, std::string &Input) {
+#ifdef SHM_COVERAGE
+  resetCoverageMap();
+#else
   // Clean up old coverage file before running 
   std::string CoveragePath = Target + ".cov";
   std::remove(CoveragePath.c_str());
+#endif
+
+  auto Start = std::chrono::steady_clock::now();
+  int ReturnCode = persistentActive() ? runTargetPersistent(Target, Input)
+                                        : runTarget(Target, Input);
+  LastExecUs = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - Start).count();
+  Stats->NumExecs++;
+  Stats->TotalExecUs += LastExecUs;
+#ifdef SHM_COVERAGE
+  // Everything downstream sees hit-count buckets, not raw counts
+  classifyCounts(TraceBits);
+#endif
+  return ReturnCode;
+}
 
+bool test(std::string &Target, std::string &Input, std::string &OutDir) {
   Count++;
-  int ReturnCode = runTarget(Target, Input);
-  switch (ReturnCode) {
-  case 0:
+  int ReturnCode = execute(Target, Input);
+  if (WIFEXITED(ReturnCode) && WEXITSTATUS(ReturnCode) == 127) {
+    fprintf(stderr, "%s not found\n", Target.c_str());
+    exit(1);
+  }
+  LastResult = classifyRun(ReturnCode);
+  if (LastResult == RESULT_TIMEOUT && ExecTimeoutMs < EXEC_TIMEOUT_MS) {
+    // The calibrated timeout is tight, a hang must time out under the full one too
+    int Calibrated = ExecTimeoutMs;
+    ExecTimeoutMs = EXEC_TIMEOUT_MS;
+    ReturnCode = execute(Target, Input);
+    RunResult Result = classifyRun(ReturnCode);
+    ExecTimeoutMs = Calibrated;
+    if (Result == RESULT_OK || Result == RESULT_OOM) {
+      // Merely slow, still no seed (LastResult stays a timeout)
+      return true;
+    }
+    LastResult = Result;
+  }
+  switch (LastResult) {
+  case RESULT_OK:
     if (Count % Freq == 0)
       storePassingInput(Input, OutDir);
     return true;
-  case 256:
-    fprintf(stderr, "%d crashes found\n", failureCount);
-    storeCrashingInput(Input, OutDir);
+  case RESULT_CRASH:
+  case RESULT_SANITIZER: {
+    // Bucketed on what the runtime reported, no need to run it again
+#ifdef SHM_COVERAGE
+    CrashReport Report = *LastCrash;
+#else
+    CrashReport Report = {};
+#endif
+    size_t NumBuckets = Triage.size();
+    if (Triage.add(Report, ReturnCode, Input, OutDir) && Triage.size() > NumBuckets) {
+      fprintf(stderr, "%zu unique crashes found (%lu in all)\n", Triage.size(),
+              (unsigned long)Triage.NumCrashes);
+    }
     return false;
-  case 127:
-    fprintf(stderr, "%s not found\n", Target.c_str());
-    exit(1);
+  }
+  case RESULT_TIMEOUT: {
+    Stats->NumTimeouts++;
+#ifdef SHM_COVERAGE
+    // Only hangs that reach code no other hang did, when there is coverage to tell
+    bool NewHang = hasNewCoverage(VirginHangs) || !hashCoverageMap();
+#else
+    bool NewHang = true;
+#endif
+    if (NewHang && NumHangs < MAX_HANGS) {
+      NumHangs++;
+      fprintf(stderr, "%d hangs found\n", NumHangs);
+      storeHangingInput(Input, OutDir);
+    }
+    return true;
+  }
+  case RESULT_OOM:
+    return true;
+  }
+  return true;
+}
+
+/**
+ * Input-to-state stage, once per seed: log the comparison operands of a run
+ * of the seed, then try it with each operand found in it replaced by the
+ * value it was compared against. Targets built without -cmplog log nothing.
+ */
+void inputToState(std::string &Target, size_t Index, std::string &OutDir) {
+  // A copy, new seeds may move SeedInputs
+  std::string Seed = SeedInputs[Index];
+  startCmpLog();
+  test(Target, Seed, OutDir);
+  stopCmpLog();
+#ifdef SHM_COVERAGE
+  // The seed's second run, what changed since the first is variable
+  if (LastResult == RESULT_OK && !Sched.Seeds[Index].Tuples.empty()) {
+    Stats->NumVariable += markVariable(Sched.Seeds[Index].Tuples, TraceBits, VariableBits);
+  }
+#endif
+
+  std::vector<std::string> Candidates;
+  collectInputToState(Seed, Candidates);
+  for (auto &Candidate : Candidates) {
+    if(PastMutantMemo.contains(Candidate)) {
+      continue;
+    }
+    PastMutantMemo.insert(Candidate);
+    NumTriedMutant += 1;
+    test(Target, Candidate, OutDir);
+    feedBack(Target, Candidate);
+  }
+}
+
+/**
+ * Deterministic stage of a seed, at most Budget mutants per call, resuming
+ * where the previous call stopped. Mutant is the caller's reusable buffer.
+ */
+void deterministicStage(std::string &Target, size_t Index, std::string &OutDir,
+                        std::string &Mutant, uint32_t Budget) {
+  // Copies and indices, new seeds may move SeedInputs and Sched.Seeds
+  std::string Seed = SeedInputs[Index];
+  if (!Sched.Seeds[Index].Det.Started) {
+    test(Target, Seed, OutDir);
+    Sched.Seeds[Index].Det.Started = true;
+#ifdef SHM_COVERAGE
+    Sched.Seeds[Index].Det.SeedHash = hashCoverageMap();
+#endif
+  }
+  for (uint32_t i = 0; i < Budget; i++) {
+    int Stage = nextDeterministic(Seed, Sched.Seeds[Index].Det, Mutant);
+    if (Stage == DET_DONE) {
+      break;
+    }
+    if (PastMutantMemo.contains(Mutant)) {
+      // Tried already, keep the byte rather than guess
+      if (Stage == DET_FLIP8) {
+        markEffector(Sched.Seeds[Index].Det, true);
+      }
+      continue;
+    }
+    PastMutantMemo.insert(Mutant);
+    NumTriedMutant += 1;
+    test(Target, Mutant, OutDir);
+    if (Stage == DET_FLIP8) {
+#ifdef SHM_COVERAGE
+      // An empty map hashes to 0: no coverage to compare, keep every byte
+      uint64_t SeedHash = Sched.Seeds[Index].Det.SeedHash;
+      markEffector(Sched.Seeds[Index].Det, !SeedHash || hashCoverageMap() != SeedHash);
+#else
+      markEffector(Sched.Seeds[Index].Det, true);
+#endif
+    }
+    feedBack(Target, Mutant);
   }
 }
 
+/**
+ * Run every initial seed once, for its exec time and coverage. Unless it
+ * was set with -t, the timeout is then calibrated on their exec times.
+ */
+void calibrateSeeds(std::string &Target, std::string &OutDir, bool CalibrateTimeout) {
+  uint64_t TotalExecUs = 0, MaxExecUs = 0;
+  size_t NumTimed = 0;
+  for (auto &Seed : SeedInputs) {
+    test(Target, Seed, OutDir);
+    if (LastResult != RESULT_TIMEOUT) {
+      TotalExecUs += LastExecUs;
+      MaxExecUs = std::max(MaxExecUs, LastExecUs);
+      NumTimed++;
+    }
+    checkCoverage(Target);
+#ifdef SHM_COVERAGE
+    Sched.addSeed(Seed.size(), LastExecUs, TraceBits);
+#else
+    Sched.addSeed(Seed.size(), LastExecUs, NULL);
+#endif
+  }
+  if (CalibrateTimeout && NumTimed) {
+    ExecTimeoutMs = calibratedTimeout(TotalExecUs / NumTimed, MaxExecUs);
+  }
+}
+
+/**
+ * Select a seed from SeedInputs, by index
+ */
+size_t selectInput(std::string &Target) {
+  // Seeds published by other workers are run once here, like the initial
+  // seeds, so that they are timed and can be top-rated for their tuples
+  while (Sched.Seeds.size() < SeedInputs.size()) {
+    std::string &Seed = SeedInputs[Sched.Seeds.size()];
+    execute(Target, Seed);
+    checkCoverage(Target);
+#ifdef SHM_COVERAGE
+    Sched.addSeed(Seed.size(), LastExecUs, TraceBits);
+#else
+    Sched.addSeed(Seed.size(), LastExecUs, NULL);
+#endif
+  }
+  return Sched.next(Rng);
+}
+
+/**
+ * Per-operator and per-stacking efficiency, overwritten every STATS_PERIOD mutants.
+ */
+void storeOperatorStats(std::string &Path) {
+  FILE *F = fopen(Path.c_str(), "w");
+  if (!F) {
+    return;
+  }
+  OperatorBandit.print(F, MutationNames);
+  fprintf(F, "\n");
+  StackBandit.print(F, StackNames);
+  if (InputGrammar.loaded()) {
+    fprintf(F, "\n");
+    LevelBandit.print(F, LevelNames);
+    fprintf(F, "\n");
+    TreeBandit.print(F, TreeMutationNames);
+  }
+  fclose(F);
+}
+
+/**
+ * Crash buckets with their counters, overwritten every STATS_PERIOD mutants.
+ */
+void storeCrashBuckets(std::string &Path) {
+  FILE *F = fopen(Path.c_str(), "w");
+  if (!F) {
+    return;
+  }
+  Triage.print(F);
+  fclose(F);
+}
+
+/**
+ * Refresh the counters that are not updated by every execution.
+ */
+void refreshStats() {
+  uint64_t Now = wallClockMs();
+  uint64_t Elapsed = Now - Stats->RefreshMs;
+  if (Elapsed) {
+    Stats->ExecsPerSec = (Stats->NumExecs - LastRefreshExecs) * 1000.0 / Elapsed;
+  }
+  LastRefreshExecs = Stats->NumExecs;
+  Stats->RefreshMs = Now;
+  Stats->NumMutants = NumTriedMutant;
+  Stats->NumDuplicates = NumDuplicateMutant;
+  Stats->NumSeeds = SeedInputs.size();
+  Stats->NumRedundant = Sched.NumRedundant;
+#ifdef SHM_COVERAGE
+  Stats->CoveragePoints = countCoverage(VirginBits);
+#else
+  Stats->CoveragePoints = PastCoverage.size();
+#endif
+  if (Stats->CoveragePoints) {
+    Stats->Stability = 100.0 * (1 - std::min<double>(
+        (double)Stats->NumVariable / Stats->CoveragePoints, 1));
+  }
+  Stats->NumCrashes = Triage.NumCrashes;
+  Stats->NumHangs = NumHangs;
+  Stats->NumBuckets = Triage.size();
+  for (int i = 0; i < NUM_MUTATION_METHODS; i++) {
+    Stats->OperatorUses[i] = OperatorBandit.Uses[i];
+    Stats->OperatorFinds[i] = OperatorBandit.Finds[i];
+    Stats->OperatorCrashes[i] = OperatorBandit.Crashes[i];
+  }
+  size_t NumListed = 0;
+  for (auto &Entry : Triage.buckets()) {
+    if (NumListed == STATS_MAX_BUCKETS) {
+      break;
+    }
+    const CrashReport &Report = Entry.second.Report;
+    Stats->Buckets[NumListed++] = {Entry.first, Entry.second.Count, Report.Kind,
+                                   Report.Signal, Report.Line, Report.Col};
+  }
+}
+
+// Scalars of the campaign, in the order of the snapshot
+struct CampaignCounters {
+  int64_t NumTriedMutant;
+  int64_t NumDuplicateMutant;
+  int64_t Count;
+  int64_t NumHangs;
+  int64_t SuccessCount;
+  int64_t FailureCount;
+  int64_t HangCount;
+  int64_t ExecTimeoutMs;
+  uint64_t ElapsedMs;
+  uint64_t NumExecs;
+  uint64_t TotalExecUs;
+  uint64_t NumTimeouts;
+  uint64_t NumVariable;
+};
+
+/**
+ * Checkpoint the worker between two mutants: the seeds go to the journal,
+ * the rest of its state to the snapshot (see Checkpoint.h).
+ */
+void saveCheckpoint() {
+  FILE *F = Ckpt.begin(SeedInputs, Sched);
+  if (!F) {
+    return;
+  }
+  CampaignCounters Counters = {NumTriedMutant,    NumDuplicateMutant, Count,
+                               NumHangs,          successCount,       failureCount,
+                               hangCount,         ExecTimeoutMs,      wallClockMs() - Stats->StartMs,
+                               Stats->NumExecs,   Stats->TotalExecUs, Stats->NumTimeouts,
+                               Stats->NumVariable};
+  writeRaw(F, &Counters, 1);
+  writeRaw(F, Rng.State, 4);
+  Sched.save(F);
+  OperatorBandit.save(F);
+  StackBandit.save(F);
+  LevelBandit.save(F);
+  TreeBandit.save(F);
+  Triage.save(F);
+  PastMutantMemo.save(F);
+#ifdef SHM_COVERAGE
+  writeRaw(F, VirginBits, MAP_SIZE);
+  writeRaw(F, VirginHangs, MAP_SIZE);
+  writeRaw(F, VariableBits, MAP_SIZE);
+#else
+  PastCoverage.save(F);
+#endif
+  Ckpt.commit(F);
+}
+
+/**
+ * Back to where the last checkpoint left the worker, PRNG included.
+ */
+bool loadCheckpoint() {
+  FILE *F = Ckpt.restore(SeedInputs, Sched);
+  if (!F) {
+    return false;
+  }
+  CampaignCounters Counters;
+  bool Loaded = readRaw(F, &Counters, 1) && readRaw(F, Rng.State, 4) && Sched.load(F) &&
+                OperatorBandit.load(F) && StackBandit.load(F) && LevelBandit.load(F) &&
+                TreeBandit.load(F) && Triage.load(F) &&
+                PastMutantMemo.load(F);
+#ifdef SHM_COVERAGE
+  std::vector<uint8_t> Virgin(MAP_SIZE), Hangs(MAP_SIZE);
+  Loaded = Loaded && readRaw(F, Virgin.data(), MAP_SIZE) && readRaw(F, Hangs.data(), MAP_SIZE) &&
+           readRaw(F, VariableBits, MAP_SIZE);
+#else
+  Loaded = Loaded && PastCoverage.load(F);
+#endif
+  fclose(F);
+  if (!Loaded) {
+    return false;
+  }
+#ifdef SHM_COVERAGE
+  // Merged into the maps the workers of -j share, covered by any is covered
+  for (int i = 0; i < MAP_SIZE; i++) {
+    VirginBits[i] &= Virgin[i];
+    VirginHangs[i] &= Hangs[i];
+  }
+#endif
+  NumTriedMutant = Counters.NumTriedMutant;
+  NumDuplicateMutant = Counters.NumDuplicateMutant;
+  Count = Counters.Count;
+  NumHangs = Counters.NumHangs;
+  successCount = Counters.SuccessCount;
+  failureCount = Counters.FailureCount;
+  hangCount = Counters.HangCount;
+  ExecTimeoutMs = Counters.ExecTimeoutMs;
+  Stats->StartMs = wallClockMs() - Counters.ElapsedMs;
+  Stats->NumExecs = LastRefreshExecs = Counters.NumExecs;
+  Stats->TotalExecUs = Counters.TotalExecUs;
+  Stats->NumTimeouts = Counters.NumTimeouts;
+  Stats->NumVariable = Counters.NumVariable;
+  return true;
+}
+
 void storeSeed(std::string &OutDir, int randomSeed) {
   std::string Path = OutDir + "/randomSeed.txt";
   std::fstream File(Path, std::fstream::out | std::ios_base::trunc);
@@ -265,8 +632,50 @@ void storeSeed(std::string &OutDir, int randomSeed) {
 }
 
 int main(int argc, char **argv) { 
+  // Anywhere on the command line: -j N runs N worker processes,
+  // -p picks the power schedule (explore, fast, coe or rare),
+  // -t sets the timeout in ms instead of calibrating it, -m the memory limit in MB,
+  // -g adds tree-level mutations on the grammar json, or the one in a file (see Grammar.h),
+  // --resume continues from the checkpoints in the output directory
+  int NumWorkers = 1;
+  bool CalibrateTimeout = true;
+  bool Resume = false;
+  std::string GrammarName;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--resume")) {
+      Resume = true;
+      std::copy(argv + i + 1, argv + argc, argv + i);
+      argc--;
+      break;
+    }
+  }
+  for (int i = 1; i < argc - 1;) {
+    if (!strcmp(argv[i], "-j")) {
+      NumWorkers = strtol(argv[i + 1], NULL, 10);
+    } else if (!strcmp(argv[i], "-t")) {
+      ExecTimeoutMs = strtol(argv[i + 1], NULL, 10);
+      CalibrateTimeout = false;
+    } else if (!strcmp(argv[i], "-m")) {
+      MemLimitMb = strtol(argv[i + 1], NULL, 10);
+    } else if (!strcmp(argv[i], "-g")) {
+      GrammarName = argv[i + 1];
+    } else if (!strcmp(argv[i], "-p")) {
+      if (!parseSchedule(argv[i + 1], Sched.Power)) {
+        fprintf(stderr, "Unknown schedule %s\n", argv[i + 1]);
+        return 1;
+      }
+    } else {
+      i++;
+      continue;
+    }
+    for (int j = i; j < argc - 2; j++) {
+      argv[j] = argv[j + 2];
+    }
+    argc -= 2;
+  }
+
   if (argc < 4) { 
-    printf("usage %s [exe file] [seed input dir] [output dir] [seed (optional arg)]\n", argv[0]);
+    printf("usage %s [-j workers] [-p schedule] [-t timeout ms] [-m memory MB] [-g grammar] [--resume] [exe file or .so for persistent mode] [seed input dir] [output dir] [seed (optional arg)]\n", argv[0]);
     return 1;
   }
 
@@ -290,30 +699,160 @@ int main(int argc, char **argv) {
   if (argc > 4) {
     randomSeed = strtol(argv[4], NULL, 10);
   }
-  srand(randomSeed);
 
   std::string Target(argv[1]);
   std::string SeedInputDir(argv[2]);
   std::string OutDir(argv[3]);
   
-  storeSeed(OutDir, randomSeed);
+  if (!Resume) {
+    storeSeed(OutDir, randomSeed);
+  }
   
   initialize(OutDir);
 
-  if (readSeedInputs(SeedInputDir)) {
+  // Resumed workers have theirs in the checkpoint
+  if (!Resume && readSeedInputs(SeedInputDir)) {
+    fprintf(stderr, "Cannot read seed input directory\n");
+    return 1;
+  }
+
+#ifdef SHM_COVERAGE
+  initVirginMap(NumWorkers > 1);
+#else
+  if (NumWorkers > 1) {
+    fprintf(stderr, "-j needs SHM_COVERAGE, workers would share the .cov file\n");
+    return 1;
+  }
+#endif
+  // Everything below is private to each worker
+  int Worker = startWorkers(NumWorkers);
+  Rng.seed(randomSeed + Worker);
+  // One set of stats and checkpoint files per worker
+  std::string Suffix = Worker > 0 ? "." + std::to_string(Worker) : "";
+  Ckpt.open(OutDir, Suffix);
+  // A worker without a checkpoint, one added since, starts from the seed inputs
+  bool Resumed = Resume && Ckpt.exists();
+  if (Resume && !Resumed && readSeedInputs(SeedInputDir)) {
     fprintf(stderr, "Cannot read seed input directory\n");
     return 1;
   }
+  PastMutantMemo.mapFile(OutDir + "/mutant_filter" + Suffix, Resumed);
+  configureStores(Suffix, Resumed);
+#ifdef SHM_COVERAGE
+  // Before the first run so that the fork server inherits it
+  initCoverageMap();
+#endif
+  initCmpLogMap();
 
+  // Persistent mode on <target>.so, with <target> as the fork server fallback
+  if (Target.size() > 3 && Target.substr(Target.size() - 3) == ".so") {
+    if (!initPersistent(Target)) {
+      return 1;
+    }
+    Target = Target.substr(0, Target.size() - 3);
+  }
+
+  SplicePartner = pickSplicePartner;
+
+  // Tokens extracted by the Dictionary pass, for the dict-* operators
+  int NumTokens = loadDictionary(Target + ".dict");
+  if (NumTokens >= 0 && Worker == 0) {
+    fprintf(stderr, "%d dictionary tokens\n", NumTokens);
+  }
+
+  if (!GrammarName.empty()) {
+    std::string Description = GrammarName;
+    if (GrammarName != "json" && stat(GrammarName.c_str(), &Buffer)) {
+      fprintf(stderr, "%s not found\n", GrammarName.c_str());
+      return 1;
+    }
+    if (GrammarName != "json") {
+      Description = readOneFile(GrammarName);
+    }
+    if (!InputGrammar.load(Description)) {
+      return 1;
+    }
+    TreeSplicePartner = pickTreePartner;
+  }
+
+  std::string StatsPath = OutDir + "/operator_stats" + Suffix;
+  std::string BucketsPath = OutDir + "/crash_buckets" + Suffix;
+  if (FuzzerStats *Mapped = mapStats(OutDir + "/fuzzer_stats" + Suffix, Worker)) {
+    Stats = Mapped;
+  }
+  FILE *Plot = openPlot(OutDir + "/plot_data" + Suffix);
+  uint64_t NextRefresh = 0, NextPlot = 0;
+
+  if (Resumed) {
+    int Timeout = ExecTimeoutMs;
+    if (!loadCheckpoint()) {
+      fprintf(stderr, "Cannot resume from the checkpoint in %s\n", OutDir.c_str());
+      return 1;
+    }
+    if (!CalibrateTimeout) {
+      ExecTimeoutMs = Timeout;
+    }
+    fprintf(stderr, "Resumed with %zu seeds after %lu executions\n", SeedInputs.size(),
+            (unsigned long)Stats->NumExecs);
+  } else {
+    calibrateSeeds(Target, OutDir, CalibrateTimeout);
+  }
+  if (Worker == 0) {
+    fprintf(stderr, "%d ms timeout\n", ExecTimeoutMs);
+  }
+  int NextStats = NumTriedMutant + STATS_PERIOD;
+  uint64_t NextCheckpoint = 0;
+
+  // Reused by every mutant, copying a seed into it does not allocate
+  std::string Mutant;
+  initMutationBuffer(Mutant);
   while (true) {
       NumTriedMutant += 1;
-      std::string SC = selectInput();
-      auto Mutant = mutate(SC);
-      test(Target, Mutant, OutDir);
-      feedBack(Target, Mutant);
+      pollSeeds(SeedInputs);
+      size_t Index = selectInput(Target);
+      Ckpt.touch(Index);
+      if(!Sched.Seeds[Index].CmpLogDone) {
+        Sched.Seeds[Index].CmpLogDone = true;
+        inputToState(Target, Index, OutDir);
+      }
+      // One slice per visit, sized on the seed's energy (see DET_SHARE)
+      SeedInfo &Seed = Sched.Seeds[Index];
+      if(Seed.Det.Stage != DET_DONE && Seed.Det.Visit != Seed.TimesFuzzed &&
+         SeedInputs[Index].size() <= DET_MAX_LEN) {
+        Seed.Det.Visit = Seed.TimesFuzzed;
+        uint32_t Budget = std::max(Sched.energy(Index) / DET_SHARE, (uint32_t)DET_SLICE);
+        deterministicStage(Target, Index, OutDir, Mutant, Budget);
+      }
+      mutate(Index, Mutant);
+      bool Passed = test(Target, Mutant, OutDir);
+      bool NewCoverage = feedBack(Target, Mutant);
+      OperatorBandit.reward(NewCoverage, !Passed);
+      StackBandit.reward(NewCoverage, !Passed);
+      LevelBandit.reward(NewCoverage, !Passed);
+      TreeBandit.reward(NewCoverage, !Passed);
+      // A clock read per mutant, from the vDSO, is lost in the exec time
+      uint64_t Now = wallClockMs();
+      if(Now>=NextRefresh) {
+        NextRefresh = Now + STATS_REFRESH_SECONDS * 1000;
+        refreshStats();
+        if(Plot && Now>=NextPlot) {
+          NextPlot = Now + STATS_PLOT_SECONDS * 1000;
+          appendPlotRow(Plot, *Stats);
+        }
+      }
+      if(Now>=NextCheckpoint) {
+        NextCheckpoint = Now + CHECKPOINT_SECONDS * 1000;
+        saveCheckpoint();
+      }
+      // Not a multiple of STATS_PERIOD, the stages before havoc count their own mutants
+      if(NumTriedMutant>=NextStats) {
+        NextStats = NumTriedMutant + STATS_PERIOD;
+        storeOperatorStats(StatsPath);
+        storeCrashBuckets(BucketsPath);
+      }
 #ifdef DEBUG
       if(NumTriedMutant%REPORT_PERIOD==0) {
-        std::cout << "[DEBUG] " << "Skipped " << NumDuplicateMutant << ", memo size " << PastMutantMemo.size() << ", #loops " << NumTriedMutant << ", #seed " << SeedInputs.size() << std::endl; 
+        std::cout << "[DEBUG] " << "Skipped " << NumDuplicateMutant << ", memo size " << PastMutantMemo.NumInserted << ", memo fill " << PastMutantMemo.fillRatio() << ", memo rebuilds " << PastMutantMemo.NumRebuilds << ", #loops " << NumTriedMutant << ", #seed " << SeedInputs.size() << ", #redundant " << Sched.NumRedundant << std::endl; 
       }
 #endif
   }
@@ -9,18 +9,21 @@
 #include <cstring>
 #include <cstdio>
 
+#include "Coverage.h"
+#include "MutantFilter.h"
 #include "Utils.h"
 
 // Uncomment to show debug messages
 // #define DEBUG
 // Though some cost to check duplicates, yet the unique number of mutants tried in fixed time is larger during measurement
 #define AVOID_DUPLICATE_MUTANT
+// Comment to fall back to the <target>.cov text file written by the runtime
+#define SHM_COVERAGE
 
 std::vector<std::string> SeedInputs;
-std::vector<std::string> PastCoverage;
-#include <unordered_map>
+CoverageSet PastCoverage;
 #define REPORT_PERIOD 1000
-std::unordered_map<std::string, int> PastMutantMemo;
+MutantFilter PastMutantMemo(MUTANT_FILTER_BYTES, MUTANT_FILTER_FP_RATE);
 int NumDuplicateMutant = 0;
 int NumTriedMutant = 0;
 
@@ -128,7 +131,7 @@ std::string mutate(std::string Origin) {
     Origin = mutateInsertMultiple(Origin);
   } 
 #ifdef AVOID_DUPLICATE_MUTANT
-  while(PastMutantMemo.find(Origin)!=PastMutantMemo.end()) {
+  while(PastMutantMemo.contains(Origin)) {
     NumDuplicateMutant += 1;
     opt = rand() % NUM_MUTATION_METHODS;
     if(opt==0) {
@@ -143,7 +146,7 @@ std::string mutate(std::string Origin) {
       Origin = mutateInsertMultiple(Origin);
     }
   }
-  PastMutantMemo.insert({Origin, 0});
+  PastMutantMemo.insert(Origin);
 #endif
   return Origin;
 }
@@ -153,14 +156,22 @@ std::string mutate(std::string Origin) {
 /*********************************************/
 
 void feedBack(std::string &Target, std::string &Mutated) {
+#ifdef SHM_COVERAGE
+  classifyCounts(TraceBits);
+  bool NewCoverage = hasNewCoverage(VirginBits);
+#ifdef DEBUG
+  if(NewCoverage) {
+    std::cout << "[DEBUG-cov] " << countCoverage(VirginBits) << " points" << std::endl;
+  }
+#endif
+#else
   std::string CovPath = Target+".cov";
   std::ifstream CovFile(CovPath);
   std::string Line;
   bool NewCoverage = false;
   if(CovFile.is_open()) {
     while(std::getline(CovFile,Line)) {
-      if(std::find(PastCoverage.begin(), PastCoverage.end(), Line)==PastCoverage.end()) {
-        PastCoverage.push_back(Line);
+      if(PastCoverage.insert(coverageKey(Line))) {
 #ifdef DEBUG
 	std::cout << "[DEBUG-cov] " << Line << std::endl;
 #endif
@@ -169,6 +180,7 @@ void feedBack(std::string &Target, std::string &Mutated) {
     }
     CovFile.close();
   }
+#endif
   if(NewCoverage) {
 #ifdef DEBUG
     std::cout << "[DEBUG-SeedInputs size before add] " << SeedInputs.size() << std::endl; 
@@ -206,9 +218,13 @@ int Freq = 1000;
 int Count = 0;
 
 bool test(std::string &Target, std::string &Input, std::string &OutDir) {
+#ifdef SHM_COVERAGE
+  resetCoverageMap();
+#else
   // Clean up old coverage file before running 
   std::string CoveragePath = Target + ".cov";
   std::remove(CoveragePath.c_str());
+#endif
 
   Count++;
   int ReturnCode = runTarget(Target, Input);
@@ -224,6 +240,16 @@ bool test(std::string &Target, std::string &Input, std::string &OutDir) {
   case 127:
     fprintf(stderr, "%s not found\n", Target.c_str());
     exit(1);
+  case RUN_TIMEOUT:
+    return true;
+  default:
+    // Killed by a signal, e.g. a segfault the sanitizer does not catch
+    if (WIFSIGNALED(ReturnCode)) {
+      fprintf(stderr, "%d crashes found\n", failureCount);
+      storeCrashingInput(Input, OutDir);
+      return false;
+    }
+    return true;
   }
 }
 
@@ -269,6 +295,11 @@ int main(int argc, char **argv) {
   storeSeed(OutDir, randomSeed);
   
   initialize(OutDir);
+#ifdef SHM_COVERAGE
+  // Before the first run so that the fork server inherits it
+  initCoverageMap();
+  initVirginMap(false);
+#endif
 
   if (readSeedInputs(SeedInputDir)) {
     fprintf(stderr, "Cannot read seed input directory\n");
@@ -283,7 +314,7 @@ int main(int argc, char **argv) {
       feedBack(Target, Mutant);
 #ifdef DEBUG
       if(NumTriedMutant%REPORT_PERIOD==0) {
-        std::cout << "[DEBUG] " << "Skipped " << NumDuplicateMutant << ", memo size " << PastMutantMemo.size() << ", #loops " << NumTriedMutant << ", #seed " << SeedInputs.size() << std::endl; 
+        std::cout << "[DEBUG] " << "Skipped " << NumDuplicateMutant << ", memo size " << PastMutantMemo.NumInserted << ", memo fill " << PastMutantMemo.fillRatio() << ", memo rebuilds " << PastMutantMemo.NumRebuilds << ", #loops " << NumTriedMutant << ", #seed " << SeedInputs.size() << std::endl; 
       }
 #endif
   }
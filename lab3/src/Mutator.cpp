@@ -0,0 +1,237 @@
+#include <algorithm>
+
+#include "Dictionary.h"
+#include "Mutator.h"
+
+void initMutationBuffer(std::string &Data) { Data.reserve(MAX_INPUT_LEN); }
+
+/**
+ * 1: Replace bytes with random values
+ */
+void mutateReplace(std::string &Data, Random &Rng) {
+  // For more effective mutation, replace all bytes (rather than just a single random byte)
+  uint8_t Mask[64];
+  for (size_t Index = 0; Index < Data.size(); Index += sizeof(Mask)) {
+    size_t Len = std::min(sizeof(Mask), Data.size() - Index);
+    Rng.fill(Mask, Len);
+    // XOR with a non-zero byte: uniform over the values different from the original
+    for (size_t i = 0; i < Len; i++) {
+      Data[Index + i] ^= Mask[i] ? Mask[i] : Rng.below(ASCII_NUM - 1) + 1;
+    }
+  }
+}
+
+/**
+ * 2: Swap adjacent bytes
+ */
+void mutateSwapAdjacent(std::string &Data, Random &Rng) {
+  size_t Size = Data.size();
+  if (Size < 2) {
+    return;
+  }
+  for (size_t Times = 0; Times < Size; Times++) {
+    // Randomly pick a swap point, the last byte swaps with the first
+    size_t Index = Rng.below(Size);
+    std::swap(Data[Index], Data[Index == Size - 1 ? 0 : Index + 1]);
+  }
+}
+
+/**
+ * 3: Rotate the bytes by a random shift
+ */
+void mutateCycle(std::string &Data, Random &Rng) {
+  if (Data.size() < 2) {
+    return;
+  }
+  size_t Shift = Rng.below(Data.size() - 1) + 1;
+  std::rotate(Data.begin(), Data.begin() + Shift, Data.end());
+}
+
+/**
+ * 4: Remove a random byte
+ */
+void mutateRemove(std::string &Data, Random &Rng) {
+  if (Data.empty()) {
+    return;
+  }
+  Data.erase(Rng.below(Data.size()), 1);
+}
+
+/**
+ * 5: Insert a random byte
+ */
+void mutateInsert(std::string &Data, Random &Rng) {
+  if (Data.size() >= MAX_INPUT_LEN) {
+    return;
+  }
+  // Any index up to Data.size() included
+  size_t Index = Rng.below(Data.size() + 1);
+  Data.insert(Index, 1, (char)(Rng.below(ASCII_NUM)));
+}
+
+/**
+ * 6: Remove up to half of the bytes, one memmove in total
+ */
+void mutateRemoveMultiple(std::string &Data, Random &Rng) {
+  size_t Size = Data.size();
+  if (Size < 2) {
+    return;
+  }
+  size_t NumRemove = Rng.below(Size / 2);
+  if (NumRemove == 0) {
+    return;
+  }
+  // Keep each byte with probability (Size - NumRemove) / Size, compacting as we go
+  size_t Kept = 0;
+  size_t Left = NumRemove;
+  for (size_t Index = 0; Index < Size; Index++) {
+    if (Left && Rng.below(Size - Index) < Left) {
+      Left--;
+      continue;
+    }
+    Data[Kept++] = Data[Index];
+  }
+  Data.resize(Kept);
+}
+
+/**
+ * 7: Insert up to Data.size() random bytes, one backward pass in total
+ */
+void mutateInsertMultiple(std::string &Data, Random &Rng) {
+  size_t Size = Data.size();
+  if (Size == 0) {
+    return;
+  }
+  size_t NumInsert = std::min(Rng.below(Size), MAX_INPUT_LEN - Size);
+  if (NumInsert == 0) {
+    return;
+  }
+  Data.resize(Size + NumInsert);
+  // Fill from the back, so that an original byte only ever moves right
+  size_t Src = Size;
+  size_t Left = NumInsert;
+  for (size_t Index = Size + NumInsert; Left; Index--) {
+    if (Rng.below(Src + Left) < Left) {
+      Data[Index - 1] = Rng.below(ASCII_NUM);
+      Left--;
+    } else {
+      Data[Index - 1] = Data[--Src];
+    }
+  }
+}
+
+/**
+ * 8: Insert a dictionary token at a random index
+ */
+void mutateDictInsert(std::string &Data, Random &Rng) {
+  // Without a dictionary, behave like mutateInsert rather than repeat the seed
+  if (Dictionary.empty()) {
+    mutateInsert(Data, Rng);
+    return;
+  }
+  const std::string &Token = Dictionary[Rng.below(Dictionary.size())];
+  if (Data.size() + Token.size() > MAX_INPUT_LEN) {
+    return;
+  }
+  Data.insert(Rng.below(Data.size() + 1), Token);
+}
+
+/**
+ * 9: Overwrite the bytes at a random index with a dictionary token
+ */
+void mutateDictOverwrite(std::string &Data, Random &Rng) {
+  if (Dictionary.empty()) {
+    mutateInsert(Data, Rng);
+    return;
+  }
+  const std::string &Token = Dictionary[Rng.below(Dictionary.size())];
+  if (Token.size() > Data.size()) {
+    return;
+  }
+  size_t Index = Rng.below(Data.size() - Token.size() + 1);
+  Data.replace(Index, Token.size(), Token);
+}
+
+const std::string *(*SplicePartner)(Random &Rng) = NULL;
+
+/**
+ * 10: Splice with a second parent, cut at a random point between the first
+ * and the last byte where the two differ, so that the result is neither
+ * parent. Either parent gives the head, the other one the tail.
+ */
+void mutateSplice(std::string &Data, Random &Rng) {
+  const std::string *Other = SplicePartner ? SplicePartner(Rng) : NULL;
+  if (!Other) {
+    mutateCycle(Data, Rng);
+    return;
+  }
+  size_t Len = std::min(Data.size(), Other->size());
+  size_t First = std::mismatch(Data.begin(), Data.begin() + Len, Other->begin()).first - Data.begin();
+  size_t Last = Len;
+  while (Last > First && Data[Last - 1] == (*Other)[Last - 1]) {
+    Last--;
+  }
+  if (Last - First < 2) {
+    // Equal over the common length: the longer one's tail is all there is
+    if (Other->size() > Data.size()) {
+      Data.append(*Other, Data.size(), std::string::npos);
+    }
+    return;
+  }
+  size_t Split = First + 1 + Rng.below(Last - First - 1);
+  if (Rng.below(2)) {
+    Data.resize(Split);
+    Data.append(*Other, Split, std::string::npos);
+  } else {
+    Data.replace(0, Split, *Other, 0, Split);
+  }
+}
+
+const char *const MutationNames[NUM_MUTATION_METHODS] = {
+    "replace", "swap-adjacent", "cycle", "remove", "insert", "remove-multiple",
+    "insert-multiple", "dict-insert", "dict-overwrite", "splice"};
+
+void mutateWith(int Operator, std::string &Data, Random &Rng) {
+  switch (Operator) {
+  case 0:
+    mutateReplace(Data, Rng);
+    break;
+  case 1:
+    mutateSwapAdjacent(Data, Rng);
+    break;
+  case 2:
+    mutateCycle(Data, Rng);
+    break;
+  case 3:
+    mutateRemove(Data, Rng);
+    break;
+  case 4:
+    mutateInsert(Data, Rng);
+    break;
+  case 5:
+    mutateRemoveMultiple(Data, Rng);
+    break;
+  case 6:
+    mutateInsertMultiple(Data, Rng);
+    break;
+  case 7:
+    mutateDictInsert(Data, Rng);
+    break;
+  case 8:
+    mutateDictOverwrite(Data, Rng);
+    break;
+  case 9:
+    mutateSplice(Data, Rng);
+    break;
+  }
+}
+
+/**
+ * Stack a random power-of-two number of random operators on Data.
+ */
+void mutateHavoc(std::string &Data, Random &Rng) {
+  int NumStacked = 1 << (Rng.below(HAVOC_STACK_POW2));
+  for (int i = 0; i < NumStacked; i++) {
+    mutateWith(Rng.below(NUM_MUTATION_METHODS), Data, Rng);
+  }
+}
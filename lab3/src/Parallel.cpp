@@ -0,0 +1,122 @@
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Parallel.h"
+#include "Utils.h"
+
+/*
+ * Parallel fuzzing (-j N): N forked workers, each with its own coverage map
+ * and fork server, sharing the virgin map and an append-only seed queue.
+ * Writers reserve an entry and its bytes with fetch_add and publish it with
+ * the Ready flag, readers follow the queue with a private cursor. No locks.
+ */
+struct SeedEntry {
+  uint64_t Offset;
+  uint32_t Size;
+  int32_t Worker;
+  std::atomic<bool> Ready;
+};
+
+struct SeedQueue {
+  std::atomic<uint64_t> NumEntries;
+  std::atomic<uint64_t> NumBytes;
+  SeedEntry Entries[SEED_QUEUE_ENTRIES];
+  char Data[SEED_QUEUE_BYTES];
+};
+
+static SeedQueue *Queue = NULL;
+static int WorkerId = 0;
+static uint64_t NextEntry = 0;
+
+/**
+ * Fork the workers and return the id of the calling one. The parent only
+ * waits for them and never returns. A single worker runs in-process.
+ */
+int startWorkers(int NumWorkers) {
+  if (NumWorkers <= 1) {
+    return 0;
+  }
+  // Pages are only backed once written
+  Queue = (SeedQueue *)mmap(NULL, sizeof(SeedQueue), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (Queue == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+
+  for (int Worker = 0; Worker < NumWorkers; Worker++) {
+    pid_t Pid = fork();
+    if (Pid < 0) {
+      perror("fork");
+      exit(1);
+    }
+    if (Pid == 0) {
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      WorkerId = Worker;
+      // Interleave the inputN names of the workers instead of sharing counters
+      successCount = failureCount = hangCount = 1 + Worker;
+      StoreStride = NumWorkers;
+      return Worker;
+    }
+  }
+  // Killing the parent takes the workers down through PR_SET_PDEATHSIG
+  while (wait(NULL) > 0) {
+  }
+  exit(0);
+}
+
+/**
+ * Hand a seed with new coverage to the other workers.
+ */
+void publishSeed(std::string &Seed) {
+  if (!Queue) {
+    return;
+  }
+  uint64_t Index = Queue->NumEntries.fetch_add(1);
+  if (Index >= SEED_QUEUE_ENTRIES) {
+    return;
+  }
+  SeedEntry &Entry = Queue->Entries[Index];
+  uint64_t Offset = Queue->NumBytes.fetch_add(Seed.size());
+  Entry.Worker = WorkerId;
+  if (Offset + Seed.size() <= SEED_QUEUE_BYTES) {
+    memcpy(&Queue->Data[Offset], Seed.data(), Seed.size());
+    Entry.Offset = Offset;
+    Entry.Size = Seed.size();
+  } else {
+    // Out of room, still publish the empty entry so readers move past it
+    Entry.Size = 0;
+  }
+  Entry.Ready.store(true, std::memory_order_release);
+}
+
+/**
+ * Pick up seeds published by the other workers since the last call.
+ */
+void pollSeeds(std::vector<std::string> &Seeds) {
+  if (!Queue) {
+    return;
+  }
+  uint64_t End = Queue->NumEntries.load(std::memory_order_acquire);
+  if (End > SEED_QUEUE_ENTRIES) {
+    End = SEED_QUEUE_ENTRIES;
+  }
+  while (NextEntry < End) {
+    SeedEntry &Entry = Queue->Entries[NextEntry];
+    if (!Entry.Ready.load(std::memory_order_acquire)) {
+      // Still being written, take it on the next poll
+      break;
+    }
+    if (Entry.Worker != WorkerId && Entry.Size) {
+      Seeds.push_back(std::string(&Queue->Data[Entry.Offset], Entry.Size));
+    }
+    NextEntry++;
+  }
+}
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Mutator.h"
+#include "Persistent.h"
+#include "Stats.h"
+#include "Utils.h"
+
+/*
+ * Persistent mode: the target is built as a shared object and its main is
+ * called in a loop through __persistent_run__ from the runtime, without
+ * spawning a process per input. The loop runs in a child forked from the
+ * fuzzer after dlopen, so that a hang can be killed rather than interrupted
+ * wherever it is (in malloc, in stdio...). The fuzzer itself never runs the
+ * target, every child starts from the same state.
+ */
+typedef int (*TargetMain)(void);
+typedef int (*PersistentRun)(TargetMain, const char *, unsigned long);
+
+static TargetMain Entry;
+static PersistentRun Run;
+static bool Active = false;
+// Shared with the child, the input of the current run
+static char *InputBuffer;
+static pid_t ChildPid = -1;
+// Run requests (input size) to the child, wait statuses back
+static int CtlFd = -1;
+static int StatusFd = -1;
+static int Iterations = 0;
+
+bool initPersistent(std::string &Library) {
+  // Without a slash dlopen would search the library path instead
+  std::string Path = Library.find('/') == std::string::npos ? "./" + Library : Library;
+  void *Handle = dlopen(Path.c_str(), RTLD_NOW);
+  if (!Handle) {
+    fprintf(stderr, "%s\n", dlerror());
+    return false;
+  }
+  Entry = (TargetMain)dlsym(Handle, "main");
+  Run = (PersistentRun)dlsym(Handle, "__persistent_run__");
+  if (!Entry || !Run) {
+    fprintf(stderr, "%s has no main or is not linked with the runtime\n", Library.c_str());
+    return false;
+  }
+  InputBuffer = (char *)mmap(NULL, MAX_INPUT_LEN, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (InputBuffer == MAP_FAILED) {
+    perror("mmap");
+    return false;
+  }
+  Active = true;
+  return true;
+}
+
+bool persistentActive() { return Active; }
+
+/*
+ * In the child: run the target on each input the fuzzer sends, until the
+ * fuzzer closes the pipe. A crash may have left the target corrupted, the
+ * child ends after reporting it.
+ */
+static void serveRuns(int Ctl, int Status) {
+  uint32_t Size;
+  while (read(Ctl, &Size, 4) == 4) {
+    int RunStatus = Run(Entry, InputBuffer, Size);
+    if (write(Status, &RunStatus, 4) != 4 || WIFSIGNALED(RunStatus)) {
+      break;
+    }
+  }
+  _exit(0);
+}
+
+static bool startChild() {
+  int CtlPipe[2], StatusPipe[2];
+  if (pipe(CtlPipe)) {
+    return false;
+  }
+  if (pipe(StatusPipe)) {
+    close(CtlPipe[0]);
+    close(CtlPipe[1]);
+    return false;
+  }
+  // A dead child must show up as a failed write, not kill the fuzzer
+  signal(SIGPIPE, SIG_IGN);
+  ChildPid = fork();
+  if (ChildPid == 0) {
+    // Gone with the fuzzer, and not its handlers for these
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    int DevNull = open("/dev/null", O_RDWR);
+    dup2(DevNull, 0);
+    dup2(DevNull, 1);
+    dup2(DevNull, 2);
+    close(DevNull);
+    close(CtlPipe[1]);
+    close(StatusPipe[0]);
+    serveRuns(CtlPipe[0], StatusPipe[1]);
+  }
+  close(CtlPipe[0]);
+  close(StatusPipe[1]);
+  if (ChildPid < 0) {
+    close(CtlPipe[1]);
+    close(StatusPipe[0]);
+    return false;
+  }
+  CtlFd = CtlPipe[1];
+  StatusFd = StatusPipe[0];
+  Iterations = 0;
+  return true;
+}
+
+// Wait status of the child, killed first unless it is gone already
+static int stopChild() {
+  int Status = 0;
+  kill(ChildPid, SIGKILL);
+  waitpid(ChildPid, &Status, 0);
+  close(CtlFd);
+  close(StatusFd);
+  ChildPid = CtlFd = StatusFd = -1;
+  return Status;
+}
+
+/**
+ * Same result as runTarget. A fresh child is forked after a crash, a
+ * timeout, or PERSISTENT_ITERATIONS runs. Target is the executable to fall
+ * back to when no child can be started.
+ */
+int runTargetPersistent(std::string &Target, std::string &Input) {
+  uint32_t Size = std::min<size_t>(Input.size(), MAX_INPUT_LEN);
+  memcpy(InputBuffer, Input.data(), Size);
+  bool Sent = ChildPid > 0 && write(CtlFd, &Size, 4) == 4;
+  if (!Sent && ChildPid > 0) {
+    // Gone since its last run
+    stopChild();
+  }
+  if (!Sent && (!startChild() || write(CtlFd, &Size, 4) != 4)) {
+    fprintf(stderr, "Cannot start the persistent target, using the fork server\n");
+    if (ChildPid > 0) {
+      stopChild();
+    }
+    Active = false;
+    return runTarget(Target, Input);
+  }
+
+  int Status;
+  struct pollfd Poll = {StatusFd, POLLIN, 0};
+  // A signal to the fuzzer is no reason to give up on the child, wait out
+  // the rest of the timeout
+  uint64_t Deadline = wallClockMs() + ExecTimeoutMs;
+  int Ready;
+  do {
+    uint64_t Now = wallClockMs();
+    Ready = poll(&Poll, 1, Now < Deadline ? Deadline - Now : 0);
+  } while (Ready < 0 && errno == EINTR);
+  if (Ready == 0) {
+    stopChild();
+    return RUN_TIMEOUT;
+  }
+  ssize_t Read;
+  do {
+    Read = Ready < 0 ? -1 : read(StatusFd, &Status, 4);
+  } while (Read < 0 && errno == EINTR);
+  if (Read != 4) {
+    // The run ended the child, its own wait status is the result
+    return stopChild();
+  }
+  if (++Iterations >= PERSISTENT_ITERATIONS || WIFSIGNALED(Status)) {
+    stopChild();
+  }
+  return Status;
+}
@@ -0,0 +1,27 @@
+#include <cstring>
+
+#include "Random.h"
+
+/**
+ * Expand Seed into the 256-bit state with splitmix64, never all zero.
+ */
+void Random::seed(uint64_t Seed) {
+  for (int i = 0; i < 4; i++) {
+    uint64_t Z = (Seed += 0x9e3779b97f4a7c15ULL);
+    Z = (Z ^ (Z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    Z = (Z ^ (Z >> 27)) * 0x94d049bb133111ebULL;
+    State[i] = Z ^ (Z >> 31);
+  }
+}
+
+void Random::fill(uint8_t *Buf, size_t Len) {
+  size_t i = 0;
+  for (; i + 8 <= Len; i += 8) {
+    uint64_t R = next();
+    memcpy(Buf + i, &R, 8);
+  }
+  if (i < Len) {
+    uint64_t R = next();
+    memcpy(Buf + i, &R, Len - i);
+  }
+}
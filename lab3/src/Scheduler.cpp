@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "Checkpoint.h"
+#include "Corpus.h"
+#include "Coverage.h"
+#include "Scheduler.h"
+
+bool parseSchedule(const char *Name, Schedule &Power) {
+  const char *Names[] = {"explore", "fast", "coe", "rare"};
+  for (int i = 0; i < 4; i++) {
+    if (!strcmp(Name, Names[i])) {
+      Power = (Schedule)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+Scheduler::Scheduler(Schedule Power)
+    : Power(Power), NumRedundant(0), Current(SIZE_MAX), Remaining(0), TotalExecUs(0),
+      NumTimed(0), TotalSize(0), MeanRarity(1), CulledSize(0) {
+  EdgeHits = (uint32_t *)calloc(MAP_SIZE, sizeof(uint32_t));
+  TopRated = (uint32_t *)malloc(NUM_TUPLES * sizeof(uint32_t));
+  memset(TopRated, 0xff, NUM_TUPLES * sizeof(uint32_t));
+  NumPendingFavored = 0;
+}
+
+Scheduler::~Scheduler() {
+  free(EdgeHits);
+  free(TopRated);
+}
+
+static double cost(const SeedInfo &Seed) { return (double)Seed.Size * Seed.ExecUs; }
+
+// Favored, never fuzzed, and not culled (that one would never be fuzzed)
+static bool pendingFavored(const SeedInfo &Seed) {
+  return Seed.NumTopRated && !Seed.TimesFuzzed && !Seed.Redundant;
+}
+
+void Scheduler::setTopRated(uint32_t Tuple, uint32_t Index) {
+  uint32_t Old = TopRated[Tuple];
+  if (Old != UINT32_MAX) {
+    NumPendingFavored -= pendingFavored(Seeds[Old]);
+    Seeds[Old].NumTopRated--;
+    NumPendingFavored += pendingFavored(Seeds[Old]);
+  }
+  TopRated[Tuple] = Index;
+  NumPendingFavored -= pendingFavored(Seeds[Index]);
+  Seeds[Index].NumTopRated++;
+  NumPendingFavored += pendingFavored(Seeds[Index]);
+}
+
+void Scheduler::addSeed(size_t Size, uint64_t ExecUs, const uint8_t *Trace) {
+  std::vector<uint32_t> Tuples;
+  if (Trace) {
+    traceTuples(Trace, Tuples);
+  }
+  addSeed(Size, ExecUs, std::move(Tuples));
+}
+
+// Hash function i of the edge signature, splitmix64's finalizer
+static uint32_t tupleHash(uint32_t Tuple, uint32_t i) {
+  uint64_t H = ((uint64_t)i << 32 | Tuple) * 0x9e3779b97f4a7c15ULL;
+  H = (H ^ H >> 30) * 0xbf58476d1ce4e5b9ULL;
+  H = (H ^ H >> 27) * 0x94d049bb133111ebULL;
+  return (H ^ H >> 31) >> 32;
+}
+
+void Scheduler::addSeed(size_t Size, uint64_t ExecUs, std::vector<uint32_t> &&Tuples) {
+  SeedInfo Seed = {Size, ExecUs, 0, 0, std::move(Tuples), {}, false, false, 0, DetProgress()};
+  std::fill_n(Seed.EdgeSig, EDGE_SIG_HASHES, UINT32_MAX);
+  for (uint32_t Tuple : Seed.Tuples) {
+    for (uint32_t i = 0; i < EDGE_SIG_HASHES; i++) {
+      Seed.EdgeSig[i] = std::min(Seed.EdgeSig[i], tupleHash(Tuple, i));
+    }
+  }
+  if (ExecUs) {
+    TotalExecUs += ExecUs;
+    NumTimed++;
+  }
+  TotalSize += Size;
+  Seeds.push_back(std::move(Seed));
+
+  // Take over the tuples it covers more cheaply, untimed seeds do not compete
+  uint32_t Index = Seeds.size() - 1;
+  if (!ExecUs) {
+    return;
+  }
+  for (uint32_t Tuple : Seeds[Index].Tuples) {
+    if (TopRated[Tuple] == UINT32_MAX || cost(Seeds[Index]) < cost(Seeds[TopRated[Tuple]])) {
+      setTopRated(Tuple, Index);
+    }
+  }
+}
+
+void Scheduler::recordExecution(const uint8_t *Trace) {
+  const uint64_t *Words = (const uint64_t *)Trace;
+  for (int i = 0; i < MAP_SIZE / 8; i++) {
+    if (!Words[i]) {
+      continue;
+    }
+    for (int b = i * 8; b < i * 8 + 8; b++) {
+      EdgeHits[b] += Trace[b] != 0;
+    }
+  }
+}
+
+void Scheduler::creditChild() {
+  if (Current < Seeds.size()) {
+    Seeds[Current].NumChildren++;
+  }
+}
+
+uint64_t Scheduler::rarity(const SeedInfo &Seed) {
+  if (Seed.Tuples.empty()) {
+    return (uint64_t)MeanRarity;
+  }
+  uint64_t Min = UINT32_MAX;
+  for (uint32_t Tuple : Seed.Tuples) {
+    Min = std::min<uint64_t>(Min, EdgeHits[Tuple >> TUPLE_BITS]);
+  }
+  return std::max<uint64_t>(Min, 1);
+}
+
+/**
+ * Mark the seeds outside a minimal covering set as redundant, weighted
+ * toward small and fast seeds. Seeds of unknown coverage are all kept.
+ */
+void Scheduler::cull() {
+  std::vector<const std::vector<uint32_t> *> Tuples;
+  std::vector<double> Costs;
+  std::vector<size_t> Traced;
+  double AvgExecUs = NumTimed ? (double)TotalExecUs / NumTimed : 1;
+  for (size_t i = 0; i < Seeds.size(); i++) {
+    Seeds[i].Redundant = !Seeds[i].Tuples.empty();
+    if (Seeds[i].Redundant) {
+      Traced.push_back(i);
+      Tuples.push_back(&Seeds[i].Tuples);
+      Costs.push_back(std::max<double>(Seeds[i].Size, 1) *
+                      (Seeds[i].ExecUs ? Seeds[i].ExecUs : AvgExecUs));
+    }
+  }
+  NumRedundant = Traced.size();
+  for (size_t i : distillCorpus(Tuples, Costs)) {
+    Seeds[Traced[i]].Redundant = false;
+    NumRedundant--;
+  }
+  CulledSize = Seeds.size();
+  NumPendingFavored = std::count_if(Seeds.begin(), Seeds.end(), pendingFavored);
+}
+
+void Scheduler::startCycle() {
+  if (CulledSize != Seeds.size()) {
+    cull();
+  }
+  double Total = 0;
+  for (auto &Seed : Seeds) {
+    Total += Seed.Tuples.empty() ? 0 : rarity(Seed);
+  }
+  size_t NumTraced = std::count_if(Seeds.begin(), Seeds.end(),
+                                   [](const SeedInfo &S) { return !S.Tuples.empty(); });
+  MeanRarity = NumTraced ? std::max(1.0, Total / NumTraced) : 1;
+}
+
+/**
+ * AFL's performance score scaled by the schedule, 0 to skip the seed.
+ */
+uint32_t Scheduler::energy(size_t Index) {
+  SeedInfo &Seed = Seeds[Index];
+  if (Seed.Redundant) {
+    return 0;
+  }
+  double Score = BASE_ENERGY;
+
+  // Fast seeds get more mutants, slow ones fewer
+  if (Seed.ExecUs && NumTimed) {
+    double AvgExecUs = (double)TotalExecUs / NumTimed;
+    if (Seed.ExecUs * 0.1 > AvgExecUs) {
+      Score = 10;
+    } else if (Seed.ExecUs * 0.25 > AvgExecUs) {
+      Score = 25;
+    } else if (Seed.ExecUs * 0.5 > AvgExecUs) {
+      Score = 50;
+    } else if (Seed.ExecUs * 0.75 > AvgExecUs) {
+      Score = 75;
+    } else if (Seed.ExecUs * 4 < AvgExecUs) {
+      Score = 300;
+    } else if (Seed.ExecUs * 3 < AvgExecUs) {
+      Score = 200;
+    } else if (Seed.ExecUs * 2 < AvgExecUs) {
+      Score = 150;
+    }
+  }
+  // Same for size, mutating huge seeds is slow and rarely pays off
+  double AvgSize = (double)TotalSize / Seeds.size();
+  if (Seed.Size > AvgSize * 4) {
+    Score *= 0.5;
+  } else if (Seed.Size > AvgSize * 2) {
+    Score *= 0.75;
+  } else if (Seed.Size * 2 < AvgSize) {
+    Score *= 1.5;
+  }
+  // Seeds whose mutants keep finding coverage are worth more
+  Score *= 1 + std::min<uint32_t>(Seed.NumChildren, 8) / 4.0;
+
+  double Rarity = rarity(Seed);
+  double Factor = 1;
+  switch (Power) {
+  case SCHEDULE_EXPLORE:
+    break;
+  case SCHEDULE_COE:
+    // Cut-off exponential: skip seeds on paths hit more than average. Not
+    // a favored seed yet to be fuzzed, the others are skipped in its favor.
+    if (Rarity > MeanRarity && !pendingFavored(Seed)) {
+      return 0;
+    }
+    // Fall through
+  case SCHEDULE_FAST:
+    // Exponential in the times fuzzed, inverse to the path frequency
+    Factor = (double)(1 << std::min<uint32_t>(Seed.TimesFuzzed, 16)) * MeanRarity / Rarity;
+    break;
+  case SCHEDULE_RARE:
+    Factor = MeanRarity / Rarity;
+    break;
+  }
+  Score *= std::min<double>(Factor, MAX_FACTOR);
+  return std::max<uint32_t>(1, std::min<double>(Score, MAX_ENERGY));
+}
+
+/**
+ * Whether to pass over the seed this time, AFL's odds for seeds that are
+ * not favored.
+ */
+bool Scheduler::skip(const SeedInfo &Seed, Random &Rng) {
+  if (NumPendingFavored) {
+    return (Seed.TimesFuzzed || !Seed.NumTopRated) && Rng.below(100) < SKIP_TO_NEW_PROB;
+  }
+  if (Seed.NumTopRated || Seeds.size() <= SKIP_MIN_SEEDS) {
+    return false;
+  }
+  return Rng.below(100) < (Seed.TimesFuzzed ? SKIP_NFAV_OLD_PROB : SKIP_NFAV_NEW_PROB);
+}
+
+size_t Scheduler::next(Random &Rng) {
+  if (Remaining > 0) {
+    Remaining--;
+    return Current;
+  }
+  // Move on to the next seed with energy, trying at most a cycle's worth
+  for (size_t Tries = 0; Tries < Seeds.size(); Tries++) {
+    Current = Current + 1 < Seeds.size() ? Current + 1 : 0;
+    if (Current == 0) {
+      startCycle();
+    }
+    if (skip(Seeds[Current], Rng)) {
+      continue;
+    }
+    Remaining = energy(Current);
+    if (Remaining > 0) {
+      break;
+    }
+  }
+  if (Remaining == 0) {
+    // Every seed was skipped or cut off, fuzz the current one anyway
+    Remaining = BASE_ENERGY;
+  }
+  NumPendingFavored -= pendingFavored(Seeds[Current]);
+  Seeds[Current].TimesFuzzed++;
+  Remaining--;
+  return Current;
+}
+
+/**
+ * Of a few random seeds, the one whose edges differ most from the current
+ * seed's, going by the signatures. Seeds covering the same code make poor
+ * parents, there is little left to combine.
+ */
+size_t Scheduler::partner(Random &Rng) {
+  if (Current >= Seeds.size() || Seeds.size() < 2) {
+    return SIZE_MAX;
+  }
+  const uint32_t *Own = Seeds[Current].EdgeSig;
+  size_t Best = SIZE_MAX;
+  int BestDistance = -1;
+  for (int i = 0; i < SPLICE_CANDIDATES; i++) {
+    size_t Other = Rng.below(Seeds.size() - 1);
+    Other += Other >= Current;
+    int Distance = 0;
+    for (int h = 0; h < EDGE_SIG_HASHES; h++) {
+      Distance += Own[h] != Seeds[Other].EdgeSig[h];
+    }
+    if (Distance > BestDistance) {
+      Best = Other;
+      BestDistance = Distance;
+    }
+  }
+  return Best;
+}
+
+/**
+ * The top-rated seeds are not saved, adding the seeds back in order rated
+ * them again. The favored seeds pending are counted over.
+ */
+void Scheduler::save(FILE *F) const {
+  writeRaw(F, EdgeHits, MAP_SIZE);
+  uint64_t Position[4] = {Current, Remaining, CulledSize, NumRedundant};
+  writeRaw(F, Position, 4);
+  writeRaw(F, &MeanRarity, 1);
+  std::vector<uint8_t> Redundant(Seeds.size());
+  for (size_t i = 0; i < Seeds.size(); i++) {
+    Redundant[i] = Seeds[i].Redundant;
+  }
+  writeVector(F, Redundant);
+}
+
+bool Scheduler::load(FILE *F) {
+  uint64_t Position[4];
+  std::vector<uint8_t> Redundant;
+  if (!readRaw(F, EdgeHits, MAP_SIZE) || !readRaw(F, Position, 4) ||
+      !readRaw(F, &MeanRarity, 1) || !readVector(F, Redundant) ||
+      Redundant.size() != Seeds.size()) {
+    return false;
+  }
+  Current = Position[0];
+  Remaining = Position[1];
+  CulledSize = Position[2];
+  NumRedundant = Position[3];
+  for (size_t i = 0; i < Seeds.size(); i++) {
+    Seeds[i].Redundant = Redundant[i];
+  }
+  NumPendingFavored = std::count_if(Seeds.begin(), Seeds.end(), pendingFavored);
+  return true;
+}
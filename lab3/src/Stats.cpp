@@ -0,0 +1,58 @@
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Stats.h"
+
+uint64_t wallClockMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+FuzzerStats *mapStats(const std::string &Path, int Worker) {
+  int Fd = open(Path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (Fd < 0 || ftruncate(Fd, sizeof(FuzzerStats))) {
+    perror(Path.c_str());
+    return NULL;
+  }
+  void *Map = mmap(NULL, sizeof(FuzzerStats), PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+  close(Fd);
+  if (Map == MAP_FAILED) {
+    perror("mmap");
+    return NULL;
+  }
+  FuzzerStats *Stats = (FuzzerStats *)Map;
+  memset(Stats, 0, sizeof(FuzzerStats));
+  Stats->Version = STATS_VERSION;
+  Stats->Pid = getpid();
+  Stats->Worker = Worker;
+  Stats->StartMs = Stats->RefreshMs = wallClockMs();
+  Stats->Stability = 100;
+  // Last, a monitor takes the file for valid once it sees it
+  Stats->Magic = STATS_MAGIC;
+  return Stats;
+}
+
+FILE *openPlot(const std::string &Path) {
+  FILE *Plot = fopen(Path.c_str(), "a");
+  if (Plot && ftell(Plot) == 0) {
+    fprintf(Plot, "# unix_time, elapsed_s, execs, execs_per_sec, avg_exec_us, seeds, "
+                  "coverage, stability, crashes, unique_crashes, hangs\n");
+  }
+  return Plot;
+}
+
+void appendPlotRow(FILE *Plot, const FuzzerStats &Stats) {
+  fprintf(Plot, "%lu, %lu, %lu, %.1f, %.1f, %lu, %lu, %.2f, %lu, %lu, %lu\n",
+          (unsigned long)(Stats.RefreshMs / 1000),
+          (unsigned long)((Stats.RefreshMs - Stats.StartMs) / 1000), (unsigned long)Stats.NumExecs,
+          Stats.ExecsPerSec,
+          Stats.NumExecs ? (double)Stats.TotalExecUs / Stats.NumExecs : 0.0,
+          (unsigned long)Stats.NumSeeds, (unsigned long)Stats.CoveragePoints, Stats.Stability,
+          (unsigned long)Stats.NumCrashes, (unsigned long)Stats.NumBuckets,
+          (unsigned long)Stats.NumHangs);
+  fflush(Plot);
+}
@@ -0,0 +1,142 @@
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Checkpoint.h"
+#include "Triage.h"
+
+static uint64_t mix(uint64_t X) {
+  X = (X ^ (X >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  X = (X ^ (X >> 27)) * 0x94d049bb133111ebULL;
+  return X ^ (X >> 31);
+}
+
+uint64_t crashSignature(const CrashReport &Report, int Status) {
+  uint64_t Key;
+  switch (Report.Kind) {
+  case CRASH_SANITIZER:
+    Key = (uint64_t)(uint32_t)Report.Line << 32 | (uint32_t)Report.Col;
+    break;
+  case CRASH_SIGNAL:
+    Key = Report.Signal;
+    for (uint32_t i = 0; i < Report.NumFrames && i < CRASH_FRAMES; i++) {
+      Key = mix(Key ^ Report.Frames[i]);
+    }
+    break;
+  default:
+    Key = (uint32_t)Status;
+    break;
+  }
+  return mix(mix(Key) ^ Report.Kind);
+}
+
+CrashTriage::CrashTriage() : NumCrashes(0) {}
+
+bool CrashTriage::add(const CrashReport &Report, int Status, const std::string &Input,
+                      const std::string &OutDir) {
+  NumCrashes++;
+  uint64_t Signature = crashSignature(Report, Status);
+  char Name[32];
+  snprintf(Name, sizeof(Name), "input-%016" PRIx64, Signature);
+  std::string Path = OutDir + "/failure/" + Name;
+
+  auto It = Buckets.find(Signature);
+  if (It == Buckets.end()) {
+    CrashBucket Bucket = {Report, Status, 0, SIZE_MAX};
+    // Another worker may have kept an input for it already
+    struct stat Buffer;
+    if (!stat(Path.c_str(), &Buffer)) {
+      Bucket.Size = Buffer.st_size;
+    }
+    It = Buckets.emplace(Signature, Bucket).first;
+  }
+  CrashBucket &Bucket = It->second;
+  Bucket.Count++;
+  if (Input.size() >= Bucket.Size) {
+    return false;
+  }
+  Bucket.Size = Input.size();
+
+  // Written aside then renamed over the old one, never seen half written
+  std::string Dir = OutDir + "/failure";
+  std::string Temp = Dir + "/." + Name + "." + std::to_string(getpid());
+  std::ofstream OutFile(Temp);
+  OutFile << Input;
+  OutFile.close();
+  // Another worker may have kept a smaller input since, compared and
+  // replaced under a lock on the directory
+  int Lock = open(Dir.c_str(), O_RDONLY);
+  if (Lock >= 0) {
+    flock(Lock, LOCK_EX);
+  }
+  struct stat Buffer;
+  bool Kept = stat(Path.c_str(), &Buffer) || (size_t)Buffer.st_size > Input.size();
+  if (Kept) {
+    rename(Temp.c_str(), Path.c_str());
+  } else {
+    unlink(Temp.c_str());
+    Bucket.Size = Buffer.st_size;
+  }
+  if (Lock >= 0) {
+    close(Lock);
+  }
+  return Kept;
+}
+
+void CrashTriage::print(FILE *F) {
+  fprintf(F, "%-16s %-24s %10s %8s\n", "signature", "crash", "count", "size");
+  for (auto &Entry : Buckets) {
+    const CrashBucket &Bucket = Entry.second;
+    char What[32];
+    switch (Bucket.Report.Kind) {
+    case CRASH_SANITIZER:
+      snprintf(What, sizeof(What), "sanitizer %d:%d", Bucket.Report.Line, Bucket.Report.Col);
+      break;
+    case CRASH_SIGNAL:
+      snprintf(What, sizeof(What), "signal %u", Bucket.Report.Signal);
+      break;
+    default:
+      if (WIFSIGNALED(Bucket.Status)) {
+        snprintf(What, sizeof(What), "signal %d, no report", WTERMSIG(Bucket.Status));
+      } else {
+        snprintf(What, sizeof(What), "exit %d, no report", WEXITSTATUS(Bucket.Status));
+      }
+      break;
+    }
+    fprintf(F, "%016" PRIx64 " %-24s %10" PRIu64 " %8zu\n", Entry.first, What, Bucket.Count,
+            Bucket.Size);
+  }
+}
+
+void CrashTriage::save(FILE *F) const {
+  writeRaw(F, &NumCrashes, 1);
+  uint64_t NumBuckets = Buckets.size();
+  writeRaw(F, &NumBuckets, 1);
+  for (auto &Entry : Buckets) {
+    writeRaw(F, &Entry.first, 1);
+    writeRaw(F, &Entry.second, 1);
+  }
+}
+
+bool CrashTriage::load(FILE *F) {
+  uint64_t NumBuckets;
+  if (!readRaw(F, &NumCrashes, 1) || !readRaw(F, &NumBuckets, 1)) {
+    return false;
+  }
+  Buckets.clear();
+  for (uint64_t i = 0; i < NumBuckets; i++) {
+    uint64_t Signature;
+    CrashBucket Bucket;
+    if (!readRaw(F, &Signature, 1) || !readRaw(F, &Bucket, 1)) {
+      return false;
+    }
+    Buckets[Signature] = Bucket;
+  }
+  return true;
+}
@@ -1,7 +1,22 @@
 # include <Utils.h>
+#include "CorpusStore.h"
+#include "Coverage.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 int successCount = 1;
 int failureCount = 1;
+int hangCount = 1;
+// Step between the inputN names, one per worker so that they never collide
+int StoreStride = 1;
+int ExecTimeoutMs = EXEC_TIMEOUT_MS;
+int MemLimitMb = MEM_LIMIT_MB;
 
 std::string readOneFile(std::string &Path) {
   std::ifstream SeedFile(Path);
@@ -10,31 +25,318 @@ std::string readOneFile(std::string &Path) {
   return Line;
 }
 
+/**
+ * Run the target through the fork server, falling back to a process per
+ * execution when the target was not instrumented with the fork server stub.
+ */
+static bool ForkServerFailed = false;
+static pid_t ForkServerPid = -1;
+static int CtlFd = -1;
+static int StatusFd = -1;
+static int InputFd = -1;
+
 int runTarget(std::string &Target, std::string &Input) {
-  std::string Cmd = Target + " > /dev/null 2>&1";
-  FILE *F = popen(Cmd.c_str(), "w");
-  fprintf(F, "%s", Input.c_str());
-  return pclose(F);
+  if (ForkServerPid < 0 && !ForkServerFailed) {
+    ForkServerFailed = !startForkServer(Target);
+  }
+  if (ForkServerFailed) {
+    return runTargetSpawn(Target, Input);
+  }
+  int Status = runTargetForkServer(Input);
+  if (ForkServerPid < 0) {
+    // The server died under us, retry once on a fresh one
+    if (!startForkServer(Target)) {
+      ForkServerFailed = true;
+      return runTargetSpawn(Target, Input);
+    }
+    Status = runTargetForkServer(Input);
+  }
+  return Status;
 }
 
-void initialize(std::string &OutDir) {
+/**
+ * Inputs are delivered through a memfd shared with every child as its stdin:
+ * pages of memory with no file system under them. An unlinked temp file where
+ * the kernel has no memfd_create.
+ */
+static size_t InputFileSize = 0;
+
+static bool openInputFile() {
+  if (InputFd < 0) {
+    InputFd = memfd_create("fuzz_input", 0);
+  }
+  if (InputFd < 0) {
+    char Path[] = "/tmp/.fuzz_input_XXXXXX";
+    InputFd = mkstemp(Path);
+    if (InputFd < 0) {
+      return false;
+    }
+    unlink(Path);
+  }
+  return true;
+}
+
+/**
+ * The pages of the previous input are written over rather than freed, only
+ * a shorter input truncates. The file offset is shared with the child, it
+ * reads from the start again.
+ */
+static void writeInputFile(std::string &Input) {
+  pwrite(InputFd, Input.data(), Input.size(), 0);
+  if (Input.size() < InputFileSize) {
+    ftruncate(InputFd, Input.size());
+  }
+  InputFileSize = Input.size();
+  lseek(InputFd, 0, SEEK_SET);
+}
+
+/**
+ * In the child about to exec the target: output to /dev/null, stdin from
+ * the input file, and the resource limits. The CPU limit is only set on a
+ * process spawned for a single execution. The fork server would count its
+ * own time over the whole campaign against it. Setting it in each of its
+ * children would cost a syscall per execution, for hangs that the
+ * wall-clock timeout catches anyway.
+ */
+static void setUpChild(bool SingleExec) {
+  int DevNull = open("/dev/null", O_RDWR);
+  dup2(DevNull, 1);
+  dup2(DevNull, 2);
+  dup2(InputFd, 0);
+  close(DevNull);
+  close(InputFd);
+
+  struct rlimit Limit;
+  if (MemLimitMb > 0) {
+    Limit.rlim_cur = Limit.rlim_max = (rlim_t)MemLimitMb << 20;
+    setrlimit(RLIMIT_AS, &Limit);
+  }
+  if (SingleExec) {
+    // Whole seconds, a backstop should the kill below fail
+    Limit.rlim_cur = Limit.rlim_max = ExecTimeoutMs / 1000 + 1;
+    setrlimit(RLIMIT_CPU, &Limit);
+  }
+  // Dumping core takes longer than most executions, and crashes are the point
+  Limit.rlim_cur = Limit.rlim_max = 0;
+  setrlimit(RLIMIT_CORE, &Limit);
+}
+
+/**
+ * One process per execution. The child holds the write end of a pipe until
+ * it exits, which lets the wait for it time out.
+ * Returns the wait status of the child, or RUN_TIMEOUT.
+ */
+int runTargetSpawn(std::string &Target, std::string &Input) {
+  int ExitPipe[2];
+  if (!openInputFile() || pipe(ExitPipe)) {
+    perror("runTargetSpawn");
+    exit(1);
+  }
+  writeInputFile(Input);
+  pid_t Pid = fork();
+  if (Pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (Pid == 0) {
+    close(ExitPipe[0]);
+    setUpChild(true);
+    execl(Target.c_str(), Target.c_str(), (char *)NULL);
+    _exit(127);
+  }
+  close(ExitPipe[1]);
+  // Readable (end of file) once the child is gone
+  struct pollfd Poll = {ExitPipe[0], POLLIN, 0};
+  bool Exited = poll(&Poll, 1, ExecTimeoutMs) > 0;
+  close(ExitPipe[0]);
+  if (!Exited) {
+    kill(Pid, SIGKILL);
+  }
   int Status;
+  waitpid(Pid, &Status, 0);
+  return Exited ? Status : RUN_TIMEOUT;
+}
+
+static void stopForkServer() {
+  if (ForkServerPid > 0) {
+    kill(ForkServerPid, SIGKILL);
+    waitpid(ForkServerPid, NULL, 0);
+  }
+  close(CtlFd);
+  close(StatusFd);
+  ForkServerPid = CtlFd = StatusFd = -1;
+}
+
+/**
+ * Read a 4-byte message from the fork server, waiting at most TimeoutMs
+ * (no limit if negative). Returns 1 on success, 0 on timeout, -1 on error.
+ */
+static int readStatus(int *Msg, int TimeoutMs) {
+  struct pollfd Poll = {StatusFd, POLLIN, 0};
+  int Ready = poll(&Poll, 1, TimeoutMs);
+  if (Ready == 0) {
+    return 0;
+  }
+  if (Ready < 0 || read(StatusFd, Msg, 4) != 4) {
+    return -1;
+  }
+  return 1;
+}
+
+bool startForkServer(std::string &Target) {
+  if (!openInputFile()) {
+    return false;
+  }
+
+  int CtlPipe[2], StatusPipe[2];
+  if (pipe(CtlPipe) || pipe(StatusPipe)) {
+    return false;
+  }
+  // A dead server must show up as a failed write, not kill the fuzzer
+  signal(SIGPIPE, SIG_IGN);
+
+  ForkServerPid = fork();
+  if (ForkServerPid < 0) {
+    return false;
+  }
+  if (ForkServerPid == 0) {
+    setUpChild(false);
+    dup2(CtlPipe[0], FORKSRV_FD);
+    dup2(StatusPipe[1], FORKSRV_FD + 1);
+    close(CtlPipe[0]);
+    close(CtlPipe[1]);
+    close(StatusPipe[0]);
+    close(StatusPipe[1]);
+    execl(Target.c_str(), Target.c_str(), (char *)NULL);
+    _exit(127);
+  }
+  close(CtlPipe[0]);
+  close(StatusPipe[1]);
+  CtlFd = CtlPipe[1];
+  StatusFd = StatusPipe[0];
+
+  // An uninstrumented target just runs on the empty input and closes the pipe
+  int Hello;
+  bool Started = readStatus(&Hello, EXEC_TIMEOUT_MS * 10) == 1;
+  if (!Started) {
+    stopForkServer();
+  }
+  // What ran before the server, or on the empty input, is no execution's
+  if (TraceBits) {
+    resetCoverageMap();
+  }
+  return Started;
+}
+
+/**
+ * Returns the wait status of the child, or RUN_TIMEOUT.
+ */
+int runTargetForkServer(std::string &Input) {
+  writeInputFile(Input);
+
+  int Msg = 0;
+  int ChildPid, Status;
+  if (write(CtlFd, &Msg, 4) != 4 || readStatus(&ChildPid, -1) != 1) {
+    stopForkServer();
+    return RUN_TIMEOUT;
+  }
+  int Ready = readStatus(&Status, ExecTimeoutMs);
+  if (Ready == 1) {
+    return Status;
+  }
+  if (Ready == 0) {
+    // Kill the hanging child, the server still reports its status
+    kill(ChildPid, SIGKILL);
+    if (readStatus(&Status, -1) == 1) {
+      return RUN_TIMEOUT;
+    }
+  }
+  stopForkServer();
+  return RUN_TIMEOUT;
+}
+
+/**
+ * What a wait status from runTarget means for the fuzzer. Exit code 1 is a
+ * sanitizer report (see lib/runtime.c), running out of CPU time under the
+ * limit is a timeout. A SIGKILL the fuzzer did not send comes from the OOM
+ * killer. An allocation refused under the memory limit shows up as whatever
+ * the target makes of it, usually a crash.
+ */
+RunResult classifyRun(int Status) {
+  if (Status == RUN_TIMEOUT) {
+    return RESULT_TIMEOUT;
+  }
+  if (WIFSIGNALED(Status)) {
+    switch (WTERMSIG(Status)) {
+    case SIGXCPU:
+      return RESULT_TIMEOUT;
+    case SIGKILL:
+      return RESULT_OOM;
+    default:
+      return RESULT_CRASH;
+    }
+  }
+  return Status == 256 ? RESULT_SANITIZER : RESULT_OK;
+}
+
+/**
+ * Timeout in ms for the exec times of the seeds, see TIMEOUT_FACTOR.
+ */
+int calibratedTimeout(uint64_t MeanExecUs, uint64_t MaxExecUs) {
+  uint64_t Us = std::max(MeanExecUs * TIMEOUT_FACTOR, MaxExecUs * 2);
+  int Ms = (Us / 1000 / TIMEOUT_STEP_MS + 1) * TIMEOUT_STEP_MS;
+  return std::min(Ms, EXEC_TIMEOUT_MS);
+}
+
+void initialize(std::string &OutDir) {
   std::string SuccessDir = OutDir + "/success";
   std::string FailureDir = OutDir + "/failure";
+  std::string HangDir = OutDir + "/hangs";
   mkdir(SuccessDir.c_str(), 0755);
   mkdir(FailureDir.c_str(), 0755);
+  mkdir(HangDir.c_str(), 0755);
+}
+
+static PackWriter SuccessPack, FailurePack, HangPack;
+static std::string StoreSuffix;
+static bool StoreAppend = false;
+
+void configureStores(const std::string &Suffix, bool Append) {
+  StoreSuffix = Suffix;
+  StoreAppend = Append;
+}
+
+/**
+ * Append Input to the pack of its kind, as inputN with N from Counter.
+ */
+static void storeInput(PackWriter &Pack, const char *Kind, std::string &Input,
+                       std::string &OutDir, int &Counter) {
+  if (!Pack.isOpen()) {
+    if (!Pack.open(OutDir + "/" + Kind + StoreSuffix, StoreAppend)) {
+      return;
+    }
+    // A resumed pack goes on from its last Id, the checkpoint's counter may
+    // be older than the inputs stored after it
+    uint32_t LastId;
+    if (Pack.lastId(LastId)) {
+      Counter = LastId + StoreStride;
+    }
+  }
+  if (!Pack.append(Input, Counter)) {
+    perror(Kind);
+    return;
+  }
+  Counter += StoreStride;
 }
 
 void storePassingInput(std::string &Input, std::string &OutDir) {
-  std::string Path = OutDir + "/success/input" + std::to_string(successCount++);
-  std::ofstream OutFile(Path);
-  OutFile << Input;
-  OutFile.close();
+  storeInput(SuccessPack, "success", Input, OutDir, successCount);
 }
 
 void storeCrashingInput(std::string &Input, std::string &OutDir) {
-  std::string Path = OutDir + "/failure/input" + std::to_string(failureCount++);
-  std::ofstream OutFile(Path);
-  OutFile << Input;
-  OutFile.close();
+  storeInput(FailurePack, "failure", Input, OutDir, failureCount);
+}
+
+void storeHangingInput(std::string &Input, std::string &OutDir) {
+  storeInput(HangPack, "hangs", Input, OutDir, hangCount);
 }